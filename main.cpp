@@ -11,14 +11,55 @@
 #define OLC_PGE_APPLICATION
 #include "olcPixelGameEngine.h"
 
+#include <random>
+#include <climits>
+#include <cctype>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
 
-// screen size in logical pixels: SW x SH
-#define SW           160                   // screen width
-#define SH           120                   // screen height
-#define pixelSize    4                     // OpenGL pixel scale
+// SSE2 is part of every x86-64 target, use it where it is available
+#if defined( __SSE2__ ) || defined( _M_X64 ) || (defined( _M_IX86_FP ) && _M_IX86_FP >= 2)
+    #define GRID2D_SSE2
+    #include <emmintrin.h>
+#endif
+// AVX2 is not part of the baseline target: the kernels that use it are compiled for it separately, and are
+// only called if the cpu supports it
+#if defined( __GNUC__ ) && (defined( __x86_64__ ) || defined( __i386__ ))
+    #define GRID2D_AVX2
+    #define GRID2D_TARGET_AVX2 __attribute__(( target( "avx2" )))
+    #include <immintrin.h>
+#elif defined( _MSC_VER ) && defined( _M_X64 )
+    #define GRID2D_AVX2
+    #define GRID2D_TARGET_AVX2
+    #include <immintrin.h>
+    #include <intrin.h>
+#endif
+
+
+// screen size in logical pixels: SW x SH. These are set at startup, see setResolution()
+int SW        = 160;                       // screen width
+int SH        = 120;                       // screen height
+int pixelSize =   4;                       // OpenGL pixel scale
 // screen size in physical pixels: GLSW x GLSH
 #define GLSW         (SW * pixelSize)      // OpenGL window width
 #define GLSH         (SH * pixelSize)      // OpenGL window height
+// the button column (taken from the T_VIEW2D sprite) is at the top right of the editor, the 2D grid covers
+// the rest. The button column starts at logical x GRID_W
+#define BUTTONS_W    15
+#define BUTTONS_H    120
+#define SNAP_RADIUS  6                     // in logical pixels: clicks snap to wall end points this close
+int GRID_W    = 145;
+// the 3D preview pane is put to the right of the editor (buttons included), so the window is SW + SW3D wide
+int SW3D      = 160;                       // 3D pane width
+int FOV       = 200;                       // 3D field of view (focal length in pixels)
+// fixed point numbers with FIX_SHIFT fractional bits, used by the 3D transform and projection
+#define FIX_SHIFT    16
+#define FIX_ONE      (1 << FIX_SHIFT)
 
 #define PI          3.1415926535f
 
@@ -61,7 +102,13 @@ int numWall =  0;                          // number of walls   - same
 
 // aux. struct for timing
 typedef struct {
-    int fr1, fr2;          // frame 1, frame 2, to create constant frame rate (in seconds)
+    int nFpsCap;           // max frames per second (0 = no cap)
+    bool bEventDriven;     // only render a frame after input or a change in the model
+    std::chrono::steady_clock::time_point tNext;   // earliest start of the next frame when capped
+    float fWork;           // time spent on rendering the last frame (in seconds)
+    float fSecond;         // time accumulated towards the next stats update (in seconds)
+    int nFrames, nDrawn;   // frames processed and frames rendered since the last stats update
+    float fFps, fDrawFps;  // frames processed and frames rendered per second
 } Timer;
 Timer T;                   // T is the global time struct
 
@@ -69,9 +116,18 @@ Timer T;                   // T is the global time struct
 typedef struct {
     float cos[360];        // save sin and cos values for [0, 359] degrees
     float sin[360];
+    int cosFix[360];       // same, in 16.16 fixed point
+    int sinFix[360];
 } TrigLookup;
 TrigLookup M;              // M is the global lookup table for cos and sin
 
+// lookup table for wall shading, shared by the 3D walls and the texture previews
+#define SHADE_LEVELS 91    // wall shade is 0 - 90 (see wallShade())
+typedef struct {
+    unsigned char shade[SHADE_LEVELS][256];    // color channel value darkened by wall shade: max( c - shade / 2, 0 )
+} ShadeLookup;
+ShadeLookup L;             // L is the global lookup table for shading
+
 // player info
 typedef struct {
     int x, y, z;           // player position. Z is up
@@ -87,7 +143,8 @@ typedef struct {
     int wt, u, v;          // wall texture and u/v tile
     int shade;             // shade of the wall
 } Wall;
-Wall W[256];               // a max of 256 walls are supported
+#define MAX_WALL     65536
+Wall W[MAX_WALL];          // a max of MAX_WALL walls are supported
 
 // sectors info
 typedef struct {
@@ -95,17 +152,70 @@ typedef struct {
     int z1, z2;            // height of bottom and top
     int d;                 // add y distances to sort drawing order
     int st, ss;            // surface texture, surface scale
-    int surf[SW];          // to hold points for surfaces
+    int inst;              // 1 + the instance the sector is expanded from, 0 if it is part of the level itself
 } Sector;
-Sector S[128];            // a max of 128 sectors are supported
+#define MAX_SECT      8192
+Sector S[MAX_SECT];        // a max of MAX_SECT sectors are supported
+
+// prefabs: groups of sectors that are defined once, and placed any number of times as instances. The walls of
+// a prefab are relative to its origin, and ws, we of its sectors index its own walls
+typedef struct {
+    std::vector<Sector> vSect;
+    std::vector<Wall>   vWall;
+} Prefab;
+std::vector<Prefab> Prefabs;
+
+// instance of a prefab: mirrored left to right (if bMirror), then turned counter clockwise by quarter turns,
+// then moved to (x, y) and up by z. The file keeps the reference only, but in memory the instance is expanded
+// into S and W when it is placed or loaded, so that drawing, picking and editing need not know about instances.
+// An instance takes as much room in S and W as a copy of its sectors (see Grid2D_port::syncInstances())
+typedef struct {
+    int prefab;            // -1 if the instance was deleted
+    int x, y, z;
+    int turn;              // 0 - 3
+    bool bMirror;
+} Instance;
+std::vector<Instance> Instances;
 
 // texture map
 typedef struct {
     int w, h;              // texture width/height
     const int *name = nullptr;   // texture name (could be better: "data", since it points at the data array
+    bool bPow2;            // both sides are a power of two: texels are addressed with wMask, hMask and wShift
+    int wMask, hMask;      // w - 1, h - 1
+    int wShift;            // log2( w )
 } TexureMaps;
 TexureMaps Textures[64];   //increase for more textures
 
+// set texture slot i to the rgb data pData of w x h texels, and pick its addressing
+void registerTexture( int i, const int *pData, int w, int h ) {
+    TexureMaps &t = Textures[i];
+    t.name = pData;
+    t.w = w;
+    t.h = h;
+    t.bPow2 = w > 0 && h > 0 && (w & (w - 1)) == 0 && (h & (h - 1)) == 0;
+    t.wMask = w - 1;
+    t.hMask = h - 1;
+    t.wShift = 0;
+    while ((1 << t.wShift) < w) {
+        t.wShift += 1;
+    }
+}
+
+// texture samplers: texel() returns the rgb of texel (tx, ty), for tx, ty >= 0 and repeating the texture.
+// The texture data is stored bottom row first, so y is flipped. Drawing code is instantiated for both, and
+// picks one per texture with the bPow2 flag
+struct SamplePow2 {
+    static const int *texel( const TexureMaps &t, int tx, int ty ) {
+        return t.name + (((~ty & t.hMask) << t.wShift) | (tx & t.wMask)) * 3;
+    }
+};
+struct SampleAny {
+    static const int *texel( const TexureMaps &t, int tx, int ty ) {
+        return t.name + ((t.h - ty % t.h - 1) * t.w + tx % t.w) * 3;
+    }
+};
+
 typedef struct {
     int mx, my;            // rounded mouse position
     int addSect;           // 0=nothing, 1=add sector
@@ -118,6 +228,843 @@ typedef struct {
 } Grid;
 Grid G;                    // this struct holds all the data for controlling the editor
 
+// version counters: bumped on every change, so that cached renderings know when they are out of date
+typedef struct {
+    int nGeometry;         // walls and sectors
+    int nEditor;           // editor settings (G), shown in the button column
+    int nView;             // 2D viewport (VP)
+} Versions;
+Versions V;
+
+// 2D viewport: world position shown at the lower left corner of the grid area, and zoom
+typedef struct {
+    float x, y;
+    float scale;           // world units per logical pixel, equals G.scale at the default zoom
+} View;
+View VP;
+
+// axis aligned bounding box in world units
+typedef struct {
+    int x1, y1;
+    int x2, y2;
+} BBox;
+
+// rectangle in logical pixels, relative to the upper left of the button column, end exclusive
+typedef struct {
+    int xs, ys, xe, ye;
+} ButtonRect;
+
+// wall and sector fields that a button changes, for applying it to a multi selection (see bulkEdit())
+enum { EDIT_WT = 1, EDIT_WU = 2, EDIT_WV = 4, EDIT_ST = 8, EDIT_SS = 16, EDIT_Z = 32 };
+
+// the buttons of the button column. A click anywhere in hit presses the button. dark is the area that is
+// darkened while the button is pressed or hovered, it is empty for buttons without feedback. edit is the
+// set of EDIT_ fields it changes. The button number is the index in Buttons[], and is looked up per pixel
+// in a hit map (see buildHitMap())
+typedef struct {
+    ButtonRect hit;
+    ButtonRect dark;
+    int edit;
+} ButtonDesc;
+enum {
+    BUTTON_NONE,
+    BUTTON_SAVE,
+    BUTTON_WU_DEC,   BUTTON_WU_INC,   BUTTON_WV_DEC, BUTTON_WV_INC,
+    BUTTON_SS_DEC,   BUTTON_SS_INC,
+    BUTTON_Z2_DEC,   BUTTON_Z2_INC,   BUTTON_Z1_DEC, BUTTON_Z1_INC,
+    BUTTON_SECT_DEC, BUTTON_SECT_INC, BUTTON_WALL_DEC, BUTTON_WALL_INC,
+    BUTTON_DELETE,   BUTTON_LOAD,     BUTTON_ADD,
+    BUTTON_WT_DEC,   BUTTON_WT_INC,   BUTTON_ST_DEC, BUTTON_ST_INC,
+    BUTTON_COUNT
+};
+const ButtonDesc Buttons[BUTTON_COUNT] = {
+    // hit                    dark                 edit
+    { {  0,   0,  0,   0 }, {  0,   0,  0,   0 }, 0       },    //  0 - no button
+    { {  0,   1, 15,   8 }, {  0,   0, 15,   8 }, 0       },    //  1 - save
+    { {  0,  25,  4,  32 }, {  0,  24,  3,  32 }, EDIT_WU },    //  2 - wall u left
+    { {  4,  25,  8,  32 }, {  4,  24,  8,  32 }, EDIT_WU },    //  3 - wall u right
+    { {  8,  25, 12,  32 }, {  7,  24, 11,  32 }, EDIT_WV },    //  4 - wall v left
+    { { 12,  25, 15,  32 }, { 11,  24, 15,  32 }, EDIT_WV },    //  5 - wall v right
+    { {  0,  49,  8,  56 }, {  0,  48,  8,  56 }, EDIT_SS },    //  6 - surface scale left
+    { {  8,  49, 15,  56 }, {  8,  48, 15,  56 }, EDIT_SS },    //  7 - surface scale right
+    { {  0,  56,  8,  64 }, {  0,  56,  7,  64 }, EDIT_Z  },    //  8 - top height left
+    { {  8,  56, 15,  64 }, {  7,  56, 15,  64 }, EDIT_Z  },    //  9 - top height right
+    { {  0,  65,  8,  72 }, {  0,  64,  7,  72 }, EDIT_Z  },    // 10 - bottom height left
+    { {  8,  65, 15,  72 }, {  7,  64, 15,  72 }, EDIT_Z  },    // 11 - bottom height right
+    { {  0,  89,  8,  97 }, {  0,  88,  7,  96 }, 0       },    // 12 - sector left
+    { {  8,  89, 15,  97 }, {  7,  88, 15,  96 }, 0       },    // 13 - sector right
+    { {  0,  97,  8, 104 }, {  0,  96,  7, 104 }, 0       },    // 14 - wall left
+    { {  8,  97, 15, 104 }, {  7,  96, 15, 104 }, 0       },    // 15 - wall right
+    { {  0, 105, 15, 112 }, {  0, 104, 15, 112 }, 0       },    // 16 - delete
+    { {  0, 113, 15, 120 }, {  0, 112, 15, 120 }, 0       },    // 17 - load
+    { {  0,  73, 15,  80 }, {  0,  72, 15,  79 }, 0       },    // 18 - add sector
+    { {  0,   9,  8,  24 }, {  0,   0,  0,   0 }, EDIT_WT },    // 19 - wall texture left
+    { {  8,   9, 15,  24 }, {  0,   0,  0,   0 }, EDIT_WT },    // 20 - wall texture right
+    { {  0,  33,  8,  48 }, {  0,   0,  0,   0 }, EDIT_ST },    // 21 - surface texture left
+    { {  8,  33, 15,  48 }, {  0,   0,  0,   0 }, EDIT_ST },    // 22 - surface texture right
+};
+
+// line segment in logical pixels, origin at lower left (same convention as drawPixel())
+typedef struct {
+    int x1, y1;
+    int x2, y2;
+    olc::Pixel col;
+} LineSeg;
+
+// a wall projected on the 3D pane, in pane pixels with origin at lower left. It is drawn column by column
+typedef struct {
+    int s, w;              // sector and wall
+    int back;              // 0 = front side (draws the wall), 1 = back side (draws the sector surface)
+    int surface;           // 0 = no surface, 1 = bottom surface, 2 = top surface
+    int x1, x2;            // screen x of both wall ends (not clipped)
+    int b1, b2;            // screen y of the bottom line at x1 and x2
+    int t1, t2;            // screen y of the top    line at x1 and x2
+} WallSpan;
+
+// point in view space, 16.16 fixed point: x to the right, y is depth, z is height
+typedef struct {
+    long long x, y, z;
+} ViewPoint;
+
+// inclusive clipping rectangle in logical pixels, origin at lower left
+typedef struct {
+    int xmin, ymin;
+    int xmax, ymax;
+} ClipRect;
+
+// wall end point, see VertexTree
+typedef struct {
+    int x, y;
+    int id;
+} KdPoint;
+
+
+//------------------------------------------------------------------------------
+
+// a fixed set of worker threads that run numbered jobs in parallel. The jobs are scheduled by work stealing:
+// every thread starts on its own contiguous range of jobs and takes them from the front. A thread that runs
+// out steals the back half of the range of another thread, so that expensive jobs don't leave threads idle
+class WorkerPool {
+
+public:
+    WorkerPool( int nThreads ) : vRanges( nThreads + 1 ) {
+        for (int i = 0; i < nThreads; i++) {
+            vThreads.push_back( std::thread( &WorkerPool::worker, this, i ));
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock( mtx );
+            bQuit = true;
+        }
+        cvWork.notify_all();
+        for (std::thread &t : vThreads) {
+            t.join();
+        }
+    }
+
+    // number of threads that can run a job: the workers plus the calling thread
+    int threads() const { return int( vThreads.size()) + 1; }
+
+    // run func( nJob, nThread ) for all nJob in [0, nJobs) and return when they are done. The calling thread
+    // takes part as thread number threads() - 1, so that per thread scratch can be indexed by nThread
+    void run( int nJobs, const std::function<void( int, int )> &func ) {
+        {
+            std::lock_guard<std::mutex> lock( mtx );
+            pFunc = &func;
+            int nThreads = threads();
+            for (int t = 0; t < nThreads; t++) {
+                vRanges[t].nRange = packRange( (long long)nJobs * t / nThreads, (long long)nJobs * (t + 1) / nThreads );
+            }
+            nBusy = int( vThreads.size());
+            nGeneration += 1;
+        }
+        cvWork.notify_all();
+        work( threads() - 1 );
+        std::unique_lock<std::mutex> lock( mtx );
+        cvDone.wait( lock, [&] { return nBusy == 0; } );
+    }
+
+private:
+    std::vector<std::thread> vThreads;
+    std::mutex mtx;
+    std::condition_variable cvWork, cvDone;
+    const std::function<void( int, int )> *pFunc = nullptr;
+    // per thread range of jobs [begin, end), packed into one word (begin in the high half), so that the owner
+    // and the thieves can both update it with a compare and swap. Padded to a cache line each
+    typedef struct alignas( 64 ) {
+        std::atomic<unsigned long long> nRange { 0 };
+    } JobRange;
+    std::vector<JobRange> vRanges;
+    int nBusy = 0;             // workers that haven't finished the current generation yet
+    int nGeneration = 0;       // bumped on every run()
+    bool bQuit = false;
+
+    static unsigned long long packRange( unsigned int nBegin, unsigned int nEnd ) {
+        return ((unsigned long long)nBegin << 32) | nEnd;
+    }
+
+    // take the first job of the own range
+    bool popJob( int nThread, int &nJob ) {
+        std::atomic<unsigned long long> &range = vRanges[nThread].nRange;
+        unsigned long long nOld = range.load();
+        while (true) {
+            unsigned int nBegin = (unsigned int)(nOld >> 32), nEnd = (unsigned int)nOld;
+            if (nBegin >= nEnd) {
+                return false;
+            }
+            if (range.compare_exchange_weak( nOld, packRange( nBegin + 1, nEnd ))) {
+                nJob = int( nBegin );
+                return true;
+            }
+        }
+    }
+
+    // move the back half (rounded up) of the first non empty range of another thread into the own range,
+    // which is empty. Returns false if there was nothing left to steal
+    bool stealJobs( int nThread ) {
+        int nThreads = threads();
+        for (int k = 1; k < nThreads; k++) {
+            std::atomic<unsigned long long> &range = vRanges[(nThread + k) % nThreads].nRange;
+            unsigned long long nOld = range.load();
+            while (true) {
+                unsigned int nBegin = (unsigned int)(nOld >> 32), nEnd = (unsigned int)nOld;
+                if (nBegin >= nEnd) {
+                    break;
+                }
+                unsigned int nSplit = nEnd - (nEnd - nBegin + 1) / 2;
+                if (range.compare_exchange_weak( nOld, packRange( nBegin, nSplit ))) {
+                    vRanges[nThread].nRange = packRange( nSplit, nEnd );
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void work( int nThread ) {
+        do {
+            for (int nJob; popJob( nThread, nJob ); ) {
+                (*pFunc)( nJob, nThread );
+            }
+        } while (stealJobs( nThread ));
+    }
+
+    void worker( int nThread ) {
+        int nSeen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock( mtx );
+                cvWork.wait( lock, [&] { return bQuit || nGeneration != nSeen; } );
+                if (bQuit) {
+                    return;
+                }
+                nSeen = nGeneration;
+            }
+            work( nThread );
+            std::lock_guard<std::mutex> lock( mtx );
+            if (--nBusy == 0) {
+                cvDone.notify_one();
+            }
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+
+// k-d tree over the end points of the walls, for nearest point and radius queries (point picking and snapping
+// in the editor). A point id is wall * 2 + end, with end 0 for (x1, y1) and 1 for (x2, y2).
+// The tree is built balanced, and kept up to date point by point: a moved or new point is inserted as a leaf,
+// a removed leaf is unlinked and reused, and a removed inner node stays in the tree marked as dead. Once the
+// dead nodes make up a large part of the tree, it is rebuilt from the live points
+class VertexTree {
+
+public:
+    // rebuild the tree from the walls of all sectors. Walls that are not part of a sector are left out
+    void build( const Sector *pSects, int nSects, const Wall *pWalls ) {
+        std::vector<KdPoint> vPoints;
+        for (int s = 0; s < nSects; s++) {
+            for (int w = pSects[s].ws; w < pSects[s].we; w++) {
+                vPoints.push_back( { pWalls[w].x1, pWalls[w].y1, w * 2     } );
+                vPoints.push_back( { pWalls[w].x2, pWalls[w].y2, w * 2 + 1 } );
+            }
+        }
+        build( vPoints );
+    }
+
+    // rebuild the tree from a list of points
+    void build( std::vector<KdPoint> &vPoints ) {
+        vNodes.clear();
+        vFree.clear();
+        std::fill( vNodeOf.begin(), vNodeOf.end(), -1 );
+        vNodes.reserve( vPoints.size());
+        nLive = int( vPoints.size());
+        nDead = 0;
+        nRoot = buildRange( vPoints, 0, nLive, 0, -1 );
+    }
+
+    // insert point id at (x, y), or move it there if it is in the tree already
+    void setPoint( int id, int x, int y ) {
+        int n = nodeOf( id );
+        if (n >= 0) {
+            if (vNodes[n].x == x && vNodes[n].y == y) {
+                return;
+            }
+            removePoint( id );
+        }
+        insert( id, x, y );
+    }
+
+    void removePoint( int id ) {
+        int n = nodeOf( id );
+        if (n < 0) {
+            return;
+        }
+        vNodeOf[id] = -1;
+        nLive -= 1;
+        KdNode &node = vNodes[n];
+        if (node.left < 0 && node.right < 0) {
+            // a leaf can be unlinked from its parent, and its node reused
+            if (node.parent < 0) {
+                nRoot = -1;
+            } else if (vNodes[node.parent].left == n) {
+                vNodes[node.parent].left = -1;
+            } else {
+                vNodes[node.parent].right = -1;
+            }
+            vFree.push_back( n );
+        } else {
+            node.id = -1;
+            nDead += 1;
+            if (nDead > 1024 && nDead > nLive) {
+                rebuild();
+            }
+        }
+    }
+
+    // id of the point nearest to (x, y) that is at most fRadius away, -1 if there is none. Of points at the
+    // same distance, the one with the lowest id is returned
+    int nearest( float x, float y, float fRadius ) const {
+        int nBest = -1;
+        float fBest = fRadius * fRadius;
+        nearest( nRoot, x, y, nBest, fBest );
+        return nBest;
+    }
+
+    // append the ids of all points at most fRadius away from (x, y) to vOut
+    void within( float x, float y, float fRadius, std::vector<int> &vOut ) const {
+        within( nRoot, x, y, fRadius * fRadius, vOut );
+    }
+
+    // append the ids of all points in the rectangle (x1, y1) - (x2, y2), borders included, to vOut
+    void inBox( int x1, int y1, int x2, int y2, std::vector<int> &vOut ) const {
+        inBox( nRoot, x1, y1, x2, y2, vOut );
+    }
+
+    // position of point id, which must be in the tree
+    void point( int id, int &x, int &y ) const {
+        x = vNodes[vNodeOf[id]].x;
+        y = vNodes[vNodeOf[id]].y;
+    }
+
+    int size() const { return nLive; }
+
+private:
+    typedef struct {
+        int x, y;
+        int id;                 // point id, -1 if the point was removed
+        int left, right;        // child nodes, -1 if none
+        int parent;             // -1 for the root
+        int axis;               // 0: split on x, 1: split on y. Left holds the smaller values, right the same or larger
+    } KdNode;
+
+    std::vector<KdNode> vNodes;
+    std::vector<int> vFree;     // unlinked nodes, for reuse
+    std::vector<int> vNodeOf;   // node of each point id, -1 if not in the tree
+    int nRoot = -1;
+    int nLive = 0, nDead = 0;
+
+    int nodeOf( int id ) const {
+        return id < int( vNodeOf.size()) ? vNodeOf[id] : -1;
+    }
+
+    int newNode( int id, int x, int y, int axis, int parent ) {
+        int n;
+        if (vFree.empty()) {
+            n = int( vNodes.size());
+            vNodes.push_back( {} );
+        } else {
+            n = vFree.back();
+            vFree.pop_back();
+        }
+        vNodes[n] = { x, y, id, -1, -1, parent, axis };
+        if (id >= int( vNodeOf.size())) {
+            vNodeOf.resize( std::max( id + 1, int( vNodeOf.size()) * 2 ), -1 );
+        }
+        vNodeOf[id] = n;
+        return n;
+    }
+
+    // balanced subtree over vPoints[lo, hi): the median on the split axis becomes the node
+    int buildRange( std::vector<KdPoint> &vPoints, int lo, int hi, int axis, int parent ) {
+        if (lo >= hi) {
+            return -1;
+        }
+        int mid = (lo + hi) / 2;
+        std::nth_element( vPoints.begin() + lo, vPoints.begin() + mid, vPoints.begin() + hi,
+                          [axis]( const KdPoint &a, const KdPoint &b ) { return axis ? a.y < b.y : a.x < b.x; } );
+        const KdPoint &p = vPoints[mid];
+        int n = newNode( p.id, p.x, p.y, axis, parent );
+        int left  = buildRange( vPoints, lo,      mid, axis ^ 1, n );
+        int right = buildRange( vPoints, mid + 1, hi,  axis ^ 1, n );
+        vNodes[n].left  = left;
+        vNodes[n].right = right;
+        return n;
+    }
+
+    void insert( int id, int x, int y ) {
+        nLive += 1;
+        if (nRoot < 0) {
+            nRoot = newNode( id, x, y, 0, -1 );
+            return;
+        }
+        int n = nRoot;
+        while (true) {
+            const KdNode &node = vNodes[n];
+            bool bLeft = node.axis ? y < node.y : x < node.x;
+            int next = bLeft ? node.left : node.right;
+            if (next < 0) {
+                int c = newNode( id, x, y, node.axis ^ 1, n );
+                if (bLeft) { vNodes[n].left  = c; }
+                else       { vNodes[n].right = c; }
+                return;
+            }
+            n = next;
+        }
+    }
+
+    void rebuild() {
+        std::vector<KdPoint> vPoints;
+        vPoints.reserve( nLive );
+        for (int id = 0; id < int( vNodeOf.size()); id++) {
+            if (vNodeOf[id] >= 0) {
+                vPoints.push_back( { vNodes[vNodeOf[id]].x, vNodes[vNodeOf[id]].y, id } );
+            }
+        }
+        build( vPoints );
+    }
+
+    void nearest( int n, float x, float y, int &nBest, float &fBest ) const {
+        if (n < 0) {
+            return;
+        }
+        const KdNode &node = vNodes[n];
+        float dx = x - node.x, dy = y - node.y;
+        float d = dx * dx + dy * dy;
+        if (node.id >= 0 && (d < fBest || (d == fBest && (nBest < 0 || node.id < nBest)))) {
+            nBest = node.id;
+            fBest = d;
+        }
+        // the side of the split that (x, y) is on first, the other side only if it can hold a point close enough
+        float fSplit = node.axis ? dy : dx;
+        nearest( fSplit < 0.0f ? node.left : node.right, x, y, nBest, fBest );
+        if (fSplit * fSplit <= fBest) {
+            nearest( fSplit < 0.0f ? node.right : node.left, x, y, nBest, fBest );
+        }
+    }
+
+    void inBox( int n, int x1, int y1, int x2, int y2, std::vector<int> &vOut ) const {
+        if (n < 0) {
+            return;
+        }
+        const KdNode &node = vNodes[n];
+        if (node.id >= 0 && node.x >= x1 && node.x <= x2 && node.y >= y1 && node.y <= y2) {
+            vOut.push_back( node.id );
+        }
+        int nSplit = node.axis ? node.y : node.x;
+        if ((node.axis ? y1 : x1) <= nSplit) {
+            inBox( node.left,  x1, y1, x2, y2, vOut );
+        }
+        if ((node.axis ? y2 : x2) >= nSplit) {
+            inBox( node.right, x1, y1, x2, y2, vOut );
+        }
+    }
+
+    void within( int n, float x, float y, float fRadius2, std::vector<int> &vOut ) const {
+        if (n < 0) {
+            return;
+        }
+        const KdNode &node = vNodes[n];
+        float dx = x - node.x, dy = y - node.y;
+        if (node.id >= 0 && dx * dx + dy * dy <= fRadius2) {
+            vOut.push_back( node.id );
+        }
+        float fSplit = node.axis ? dy : dx;
+        if (fSplit < 0.0f || fSplit * fSplit <= fRadius2) {
+            within( node.left,  x, y, fRadius2, vOut );
+        }
+        if (fSplit >= 0.0f || fSplit * fSplit <= fRadius2) {
+            within( node.right, x, y, fRadius2, vOut );
+        }
+    }
+};
+VertexTree VT;             // end points of all walls, see setWallPoint()
+
+// walls with an end point that moved since their shade was computed (see updateShades())
+std::vector<int> vShadeDirty;
+unsigned char bShadeDirty[MAX_WALL];       // 1 if the wall is in vShadeDirty
+
+// set end point 1 or 2 of wall w. Edits of single points go through here, so that VT stays up to date, and the
+// shade of the wall is recomputed. Bulk edits update VT and the shades themselves, or rebuild them
+void setWallPoint( int w, int end, int x, int y ) {
+    if (end == 1) {
+        W[w].x1 = x;
+        W[w].y1 = y;
+    } else {
+        W[w].x2 = x;
+        W[w].y2 = y;
+    }
+    VT.setPoint( w * 2 + end - 1, x, y );
+    if (!bShadeDirty[w]) {
+        bShadeDirty[w] = 1;
+        vShadeDirty.push_back( w );
+    }
+}
+
+// automatic shading of a wall running (dx, dy) from its first to its second end point: from 0 for walls
+// along the x axis to 90 for walls along the y axis
+int wallShade( int dx, int dy ) {
+    float ang = atan2f( dy, dx );
+    ang = (ang * 180) / PI;      // radians to degrees
+    if(ang < 0) { ang += 360; }  // correct negative
+    int shade = ang;             // shading goes from 0-90-0-90-0
+    if(shade > 180) { shade = 180 - (shade - 180); }
+    if(shade >  90) { shade =  90 - (shade -  90); }
+    return shade;
+}
+
+// the batch version of wallShade(), for the n walls listed in pWalls, or for walls 0 .. n - 1 if pWalls is
+// null. The angle comes from a polynomial approximation of atan (Abramowitz & Stegun 4.4.49, error below
+// 1e-5 radians), four walls at a time with SSE2. Only its whole degrees matter, so where it is further than
+// SHADE_MARGIN from a whole degree, the result is the same as that of wallShade(). Other walls use wallShade(),
+// and walls along an axis a table
+#define SHADE_MARGIN (1.0f / 128.0f)
+void shadeWalls( const int *pWalls, int n ) {
+    static const int nAxis[4] = { wallShade( 1, 0 ), wallShade( 0, 1 ), wallShade( -1, 0 ), wallShade( 0, -1 ) };
+    // atan( z ) for z in [0, 1], in degrees
+    const float c0 = 0.9998660f * 180 / PI, c1 = -0.3302995f * 180 / PI, c2 = 0.1801410f * 180 / PI,
+                c3 = -0.0851330f * 180 / PI, c4 = 0.0208351f * 180 / PI;
+    auto wallAt = [=]( int i ) { return pWalls ? pWalls[i] : i; };
+    auto exact = [&]( int w ) {
+        int dx = W[w].x2 - W[w].x1, dy = W[w].y2 - W[w].y1;
+        if      (dy == 0) { W[w].shade = nAxis[dx < 0 ? 2 : 0]; }
+        else if (dx == 0) { W[w].shade = nAxis[dy < 0 ? 3 : 1]; }
+        else              { W[w].shade = wallShade( dx, dy );   }
+    };
+    int i = 0;
+#ifdef GRID2D_SSE2
+    const __m128 vSign = _mm_set1_ps( -0.0f ), vOne = _mm_set1_ps( 1.0f ), vZero = _mm_setzero_ps();
+    const __m128 v90 = _mm_set1_ps( 90.0f ), v180 = _mm_set1_ps( 180.0f ), v360 = _mm_set1_ps( 360.0f );
+    const __m128 vMargin = _mm_set1_ps( SHADE_MARGIN ), vMarginHi = _mm_set1_ps( 1.0f - SHADE_MARGIN );
+    const __m128i vI90 = _mm_set1_epi32( 90 ), vI180 = _mm_set1_epi32( 180 ), vI360 = _mm_set1_epi32( 360 );
+    auto select = []( __m128 m, __m128 a, __m128 b ) { return _mm_or_ps( _mm_and_ps( m, a ), _mm_andnot_ps( m, b )); };
+    auto selecti = []( __m128i m, __m128i a, __m128i b ) { return _mm_or_si128( _mm_and_si128( m, a ), _mm_andnot_si128( m, b )); };
+    for (; i + 4 <= n; i += 4) {
+        int w0 = wallAt( i ), w1 = wallAt( i + 1 ), w2 = wallAt( i + 2 ), w3 = wallAt( i + 3 );
+        __m128i vDX = _mm_setr_epi32( W[w0].x2 - W[w0].x1, W[w1].x2 - W[w1].x1, W[w2].x2 - W[w2].x1, W[w3].x2 - W[w3].x1 );
+        __m128i vDY = _mm_setr_epi32( W[w0].y2 - W[w0].y1, W[w1].y2 - W[w1].y1, W[w2].y2 - W[w2].y1, W[w3].y2 - W[w3].y1 );
+        __m128 vX = _mm_cvtepi32_ps( vDX ), vY = _mm_cvtepi32_ps( vDY );
+        __m128 vAX = _mm_andnot_ps( vSign, vX ), vAY = _mm_andnot_ps( vSign, vY );
+        __m128 vZ = _mm_div_ps( _mm_min_ps( vAX, vAY ), _mm_max_ps( _mm_max_ps( vAX, vAY ), vOne ));
+        __m128 vZ2 = _mm_mul_ps( vZ, vZ );
+        __m128 vA = _mm_add_ps( _mm_set1_ps( c3 ), _mm_mul_ps( vZ2, _mm_set1_ps( c4 )));
+        vA = _mm_add_ps( _mm_set1_ps( c2 ), _mm_mul_ps( vZ2, vA ));
+        vA = _mm_add_ps( _mm_set1_ps( c1 ), _mm_mul_ps( vZ2, vA ));
+        vA = _mm_mul_ps( vZ, _mm_add_ps( _mm_set1_ps( c0 ), _mm_mul_ps( vZ2, vA )));
+        // from the first octant to the full circle, 0 - 360 degrees
+        vA = select( _mm_cmpgt_ps( vAY, vAX ), _mm_sub_ps( v90, vA ), vA );
+        vA = select( _mm_cmplt_ps( vX, vZero ), _mm_sub_ps( v180, vA ), vA );
+        vA = select( _mm_cmplt_ps( vY, vZero ), _mm_sub_ps( v360, vA ), vA );
+        __m128i vShade = _mm_cvttps_epi32( vA );
+        __m128 vFrac = _mm_sub_ps( vA, _mm_cvtepi32_ps( vShade ));
+        // shading goes from 0-90-0-90-0
+        vShade = selecti( _mm_cmpgt_epi32( vShade, vI180 ), _mm_sub_epi32( vI360, vShade ), vShade );
+        vShade = selecti( _mm_cmpgt_epi32( vShade, vI90  ), _mm_sub_epi32( vI180, vShade ), vShade );
+        int nExact = _mm_movemask_ps( _mm_or_ps( _mm_or_ps( _mm_cmplt_ps( vFrac, vMargin ), _mm_cmpgt_ps( vFrac, vMarginHi )),
+                                                 _mm_or_ps( _mm_cmpeq_ps( vX, vZero ), _mm_cmpeq_ps( vY, vZero ))));
+        alignas( 16 ) int vOut[4];
+        _mm_store_si128( (__m128i *)vOut, vShade );
+        const int vW[4] = { w0, w1, w2, w3 };
+        for (int k = 0; k < 4; k++) {
+            if (nExact & (1 << k)) { exact( vW[k] ); }
+            else                   { W[vW[k]].shade = vOut[k]; }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        int w = wallAt( i );
+        float fX = float( W[w].x2 - W[w].x1 ), fY = float( W[w].y2 - W[w].y1 );
+        float fAX = std::abs( fX ), fAY = std::abs( fY );
+        float fZ = std::min( fAX, fAY ) / std::max( std::max( fAX, fAY ), 1.0f ), fZ2 = fZ * fZ;
+        float fA = fZ * (c0 + fZ2 * (c1 + fZ2 * (c2 + fZ2 * (c3 + fZ2 * c4))));
+        if (fAY > fAX) { fA =  90.0f - fA; }
+        if (fX < 0.0f) { fA = 180.0f - fA; }
+        if (fY < 0.0f) { fA = 360.0f - fA; }
+        int nShade = int( fA );
+        float fFrac = fA - float( nShade );
+        if (fFrac < SHADE_MARGIN || fFrac > 1.0f - SHADE_MARGIN || fX == 0.0f || fY == 0.0f) {
+            exact( w );
+            continue;
+        }
+        if (nShade > 180) { nShade = 360 - nShade; }
+        if (nShade >  90) { nShade = 180 - nShade; }
+        W[w].shade = nShade;
+    }
+}
+
+// recompute the shade of the walls that had an end point moved
+void updateShades() {
+    shadeWalls( vShadeDirty.data(), int( vShadeDirty.size()));
+    for (int w : vShadeDirty) {
+        bShadeDirty[w] = 0;
+    }
+    vShadeDirty.clear();
+}
+
+//------------------------------------------------------------------------------
+
+// view space end points of a run of walls, in 16.16 fixed point (see Grid2D_port::toView()). Per wall, near
+// has bit 0 set if end point 1 is behind the near plane y = 1, and bit 1 for end point 2
+typedef struct {
+    long long *x1, *y1;
+    long long *x2, *y2;
+    unsigned char *near;
+} WallViews;
+
+// rotate nWalls walls, relative to player position (px, py), into view space
+void transformWallsScalar( const Wall *pWalls, int nWalls, int px, int py, int nCos, int nSin, const WallViews &out ) {
+    for (int i = 0; i < nWalls; i++) {
+        int x1 = pWalls[i].x1 - px, y1 = pWalls[i].y1 - py;
+        int x2 = pWalls[i].x2 - px, y2 = pWalls[i].y2 - py;
+        out.x1[i] = (long long)x1 * nCos - (long long)y1 * nSin;
+        out.y1[i] = (long long)y1 * nCos + (long long)x1 * nSin;
+        out.x2[i] = (long long)x2 * nCos - (long long)y2 * nSin;
+        out.y2[i] = (long long)y2 * nCos + (long long)x2 * nSin;
+        out.near[i] = (out.y1[i] < FIX_ONE ? 1 : 0) | (out.y2[i] < FIX_ONE ? 2 : 0);
+    }
+}
+
+#ifdef GRID2D_AVX2
+// rotate 8 points (x, y) with 64 bit results. _mm256_mul_epi32 multiplies the even 32 bit lanes into 64 bits,
+// the odd lanes are shifted down to be multiplied as well. Results are stored in point order, and the return
+// value has bit i set if point i is behind the near plane
+GRID2D_TARGET_AVX2
+inline int rotateAVX2( __m256i x, __m256i y, __m256i vCos, __m256i vSin, long long *pX, long long *pY ) {
+    __m256i xOdd = _mm256_srli_epi64( x, 32 ), yOdd = _mm256_srli_epi64( y, 32 );
+    __m256i vxEven = _mm256_sub_epi64( _mm256_mul_epi32( x,    vCos ), _mm256_mul_epi32( y,    vSin ));
+    __m256i vxOdd  = _mm256_sub_epi64( _mm256_mul_epi32( xOdd, vCos ), _mm256_mul_epi32( yOdd, vSin ));
+    __m256i vyEven = _mm256_add_epi64( _mm256_mul_epi32( y,    vCos ), _mm256_mul_epi32( x,    vSin ));
+    __m256i vyOdd  = _mm256_add_epi64( _mm256_mul_epi32( yOdd, vCos ), _mm256_mul_epi32( xOdd, vSin ));
+    // even lanes hold points 0, 2, 4, 6 and odd lanes 1, 3, 5, 7: interleave them back into point order
+    __m256i vxLo = _mm256_unpacklo_epi64( vxEven, vxOdd ), vxHi = _mm256_unpackhi_epi64( vxEven, vxOdd );
+    __m256i vyLo = _mm256_unpacklo_epi64( vyEven, vyOdd ), vyHi = _mm256_unpackhi_epi64( vyEven, vyOdd );
+    __m256i vy0123 = _mm256_permute2x128_si256( vyLo, vyHi, 0x20 );
+    __m256i vy4567 = _mm256_permute2x128_si256( vyLo, vyHi, 0x31 );
+    _mm256_storeu_si256( (__m256i *)(pX + 0), _mm256_permute2x128_si256( vxLo, vxHi, 0x20 ));
+    _mm256_storeu_si256( (__m256i *)(pX + 4), _mm256_permute2x128_si256( vxLo, vxHi, 0x31 ));
+    _mm256_storeu_si256( (__m256i *)(pY + 0), vy0123 );
+    _mm256_storeu_si256( (__m256i *)(pY + 4), vy4567 );
+    // near plane classification: y < FIX_ONE
+    __m256i vOne = _mm256_set1_epi64x( FIX_ONE );
+    int nLo = _mm256_movemask_pd( _mm256_castsi256_pd( _mm256_cmpgt_epi64( vOne, vy0123 )));
+    int nHi = _mm256_movemask_pd( _mm256_castsi256_pd( _mm256_cmpgt_epi64( vOne, vy4567 )));
+    return nLo | (nHi << 4);
+}
+
+// spread the 8 bits of m over the lowest bit of 8 bytes
+inline unsigned long long spreadBits( int m ) {
+    return (((m & 15) * 0x00204081ULL) & 0x01010101ULL) | ((((m >> 4) * 0x00204081ULL) & 0x01010101ULL) << 32);
+}
+
+// same as transformWallsScalar(), 8 walls per iteration. All math is exact integer math, so the results are
+// identical
+GRID2D_TARGET_AVX2
+void transformWallsAVX2( const Wall *pWalls, int nWalls, int px, int py, int nCos, int nSin, const WallViews &out ) {
+    static_assert( sizeof( Wall ) == 8 * sizeof( int ), "transformWallsAVX2() assumes 8 ints per wall" );
+    const __m256i vPos = _mm256_setr_epi32( px, py, px, py, px, py, px, py );
+    const __m256i vCos = _mm256_set1_epi32( nCos ), vSin = _mm256_set1_epi32( nSin );
+    int i = 0;
+    for (; i + 8 <= nWalls; i += 8) {
+        // the end points (x1, y1, x2, y2) of walls k and k + 4 go in one register, relative to the player
+        const Wall *pW = pWalls + i;
+        __m256i a = _mm256_sub_epi32( _mm256_loadu2_m128i( (const __m128i *)&pW[4], (const __m128i *)&pW[0] ), vPos );
+        __m256i b = _mm256_sub_epi32( _mm256_loadu2_m128i( (const __m128i *)&pW[5], (const __m128i *)&pW[1] ), vPos );
+        __m256i c = _mm256_sub_epi32( _mm256_loadu2_m128i( (const __m128i *)&pW[6], (const __m128i *)&pW[2] ), vPos );
+        __m256i d = _mm256_sub_epi32( _mm256_loadu2_m128i( (const __m128i *)&pW[7], (const __m128i *)&pW[3] ), vPos );
+        // 4x4 transpose per 128 bit lane, giving one register per field with walls 0..7 in order
+        __m256i t0 = _mm256_unpacklo_epi32( a, b ), t1 = _mm256_unpacklo_epi32( c, d );
+        __m256i t2 = _mm256_unpackhi_epi32( a, b ), t3 = _mm256_unpackhi_epi32( c, d );
+        __m256i x1 = _mm256_unpacklo_epi64( t0, t1 ), y1 = _mm256_unpackhi_epi64( t0, t1 );
+        __m256i x2 = _mm256_unpacklo_epi64( t2, t3 ), y2 = _mm256_unpackhi_epi64( t2, t3 );
+        int nNear1 = rotateAVX2( x1, y1, vCos, vSin, out.x1 + i, out.y1 + i );
+        int nNear2 = rotateAVX2( x2, y2, vCos, vSin, out.x2 + i, out.y2 + i );
+        unsigned long long nFlags = spreadBits( nNear1 ) | (spreadBits( nNear2 ) << 1);
+        std::memcpy( out.near + i, &nFlags, 8 );
+    }
+    WallViews tail = { out.x1 + i, out.y1 + i, out.x2 + i, out.y2 + i, out.near + i };
+    transformWallsScalar( pWalls + i, nWalls - i, px, py, nCos, nSin, tail );
+}
+#endif
+
+// runtime check for AVX2 support, by the cpu and by the OS (saving the ymm registers on context switches)
+bool cpuHasAVX2() {
+#if defined( GRID2D_AVX2 ) && defined( __GNUC__ )
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "avx2" );
+#elif defined( GRID2D_AVX2 )
+    int r[4];
+    __cpuid( r, 0 );
+    if (r[0] < 7) {
+        return false;
+    }
+    __cpuid( r, 1 );
+    bool bOSXSave = (r[2] & (1 << 27)) != 0, bAVX = (r[2] & (1 << 28)) != 0;
+    if (!bOSXSave || !bAVX || (_xgetbv( 0 ) & 6) != 6) {
+        return false;
+    }
+    __cpuidex( r, 7, 0 );
+    return (r[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
+// set the logical screen size and the pixel scale, and the layout that depends on them. The 3D pane is as
+// wide as the editor, and its focal length scales with the width, so that the field of view stays the same.
+// The editor is at least as high as the button column, which is anchored at its bottom
+void setResolution( int nWidth, int nHeight, int nPixelSize ) {
+    SW = std::max( nWidth, BUTTONS_W + 16 );
+    SH = std::max( nHeight, BUTTONS_H );
+    pixelSize = std::max( nPixelSize, 1 );
+    GRID_W = SW - BUTTONS_W;
+    SW3D = SW;
+    FOV = SW3D * 5 / 4;
+}
+
+// image output for headless rendering. Both writers take the sprite as is (top row first) and drop alpha
+
+// binary PPM (P6), the simplest format most image tools read
+bool writePPM( const std::string &sFile, const olc::Sprite &spr ) {
+    std::ofstream fp( sFile, std::ios::binary );
+    if (!fp.is_open()) {
+        std::cout << "ERROR: writePPM() --> error opening file: " << sFile << std::endl;
+        return false;
+    }
+    fp << "P6\n" << spr.width << " " << spr.height << "\n255\n";
+    std::vector<unsigned char> vRow( spr.width * 3 );
+    for (int y = 0; y < spr.height; y++) {
+        for (int x = 0; x < spr.width; x++) {
+            const olc::Pixel &p = spr.pColData[y * spr.width + x];
+            vRow[x * 3 + 0] = p.r;
+            vRow[x * 3 + 1] = p.g;
+            vRow[x * 3 + 2] = p.b;
+        }
+        fp.write( (const char *)vRow.data(), vRow.size() );
+    }
+    return fp.good();
+}
+
+// PNG with an uncompressed (stored) deflate stream, so that no zlib is needed. The files are about the
+// size of a PPM, which is fine for thumbnails and regression images
+unsigned int pngCrc32( unsigned int nCrc, const unsigned char *pData, size_t nLen ) {
+    static unsigned int vTable[256];
+    static bool bTable = false;
+    if (!bTable) {
+        for (unsigned int n = 0; n < 256; n++) {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            vTable[n] = c;
+        }
+        bTable = true;
+    }
+    nCrc = ~nCrc;
+    for (size_t i = 0; i < nLen; i++) {
+        nCrc = vTable[(nCrc ^ pData[i]) & 0xFF] ^ (nCrc >> 8);
+    }
+    return ~nCrc;
+}
+
+bool writePNG( const std::string &sFile, const olc::Sprite &spr ) {
+    // raw image data: each row starts with filter type 0 (none)
+    size_t nRow = size_t( spr.width ) * 3 + 1;
+    std::vector<unsigned char> vRaw( nRow * spr.height );
+    for (int y = 0; y < spr.height; y++) {
+        unsigned char *pRow = vRaw.data() + y * nRow;
+        pRow[0] = 0;
+        for (int x = 0; x < spr.width; x++) {
+            const olc::Pixel &p = spr.pColData[y * spr.width + x];
+            pRow[1 + x * 3 + 0] = p.r;
+            pRow[1 + x * 3 + 1] = p.g;
+            pRow[1 + x * 3 + 2] = p.b;
+        }
+    }
+    // zlib stream: header, stored blocks of at most 65535 bytes, adler32 of the raw data
+    std::vector<unsigned char> vZlib = { 0x78, 0x01 };
+    size_t nPos = 0;
+    do {
+        size_t nLen = std::min( vRaw.size() - nPos, size_t( 65535 ));
+        bool bLast = nPos + nLen == vRaw.size();
+        vZlib.push_back( bLast ? 1 : 0 );
+        vZlib.push_back( (unsigned char)( nLen       & 0xFF ));
+        vZlib.push_back( (unsigned char)((nLen >> 8) & 0xFF ));
+        vZlib.push_back( (unsigned char)(~nLen       & 0xFF ));
+        vZlib.push_back( (unsigned char)((~nLen >> 8) & 0xFF ));
+        vZlib.insert( vZlib.end(), vRaw.begin() + nPos, vRaw.begin() + nPos + nLen );
+        nPos += nLen;
+    } while (nPos < vRaw.size());
+    unsigned int a = 1, b = 0;
+    for (unsigned char c : vRaw) {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+    unsigned int nAdler = (b << 16) | a;
+    for (int k = 3; k >= 0; k--) {
+        vZlib.push_back( (unsigned char)(nAdler >> (k * 8)) );
+    }
+
+    std::ofstream fp( sFile, std::ios::binary );
+    if (!fp.is_open()) {
+        std::cout << "ERROR: writePNG() --> error opening file: " << sFile << std::endl;
+        return false;
+    }
+    auto put32 = []( std::vector<unsigned char> &v, unsigned int n ) {
+        for (int k = 3; k >= 0; k--) {
+            v.push_back( (unsigned char)(n >> (k * 8)) );
+        }
+    };
+    // chunk: length, type, data, crc over type and data
+    auto chunk = [&]( const char *sType, const std::vector<unsigned char> &vData ) {
+        std::vector<unsigned char> v;
+        put32( v, (unsigned int)vData.size() );
+        v.insert( v.end(), sType, sType + 4 );
+        v.insert( v.end(), vData.begin(), vData.end() );
+        put32( v, pngCrc32( 0, v.data() + 4, v.size() - 4 ));
+        fp.write( (const char *)v.data(), v.size() );
+    };
+    const unsigned char vSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fp.write( (const char *)vSignature, 8 );
+    std::vector<unsigned char> vHeader;
+    put32( vHeader, spr.width );
+    put32( vHeader, spr.height );
+    vHeader.insert( vHeader.end(), { 8, 2, 0, 0, 0 } );    // 8 bit, rgb, deflate, no filter, no interlace
+    chunk( "IHDR", vHeader );
+    chunk( "IDAT", vZlib );
+    chunk( "IEND", {} );
+    return fp.good();
+}
 
 //------------------------------------------------------------------------------
 
@@ -133,48 +1080,177 @@ public:
 private:
     // put your class variables here
 
-    // save current content for sectors, walls and player to file
+    // save current content for sectors, walls and player to file. Instances are saved as a reference to their
+    // prefab, after the player position, and the prefabs once each
     void save() {
         std::ofstream fp( LEVEL_FILE );
         if(!fp.is_open()) {
             std::cout << "ERROR: save() --> error opening file: " << LEVEL_FILE << std::endl;
         } else {
             if(numSect > 0) {
-                // save sector data
-                fp << numSect << std::endl;
+                syncInstances();
+                auto saveSector = [&]( const Sector &sect, int ws ) {
+                    fp << ws << " " << ws + sect.we - sect.ws << " " << sect.z1 << " " << sect.z2 << " " << sect.st << " " << sect.ss << std::endl;
+                };
+                auto saveWall = [&]( const Wall &wall ) {
+                    fp << wall.x1 << " " << wall.y1 << " " << wall.x2 << " " << wall.y2 << " " << wall.wt << " " << wall.u << " " << wall.v << " " << wall.shade << std::endl;
+                };
+                // save sector data, of the level itself
+                int nSect = 0, nWall = 0;
                 for (int s = 0; s < numSect; s++) {
-                    fp << S[s].ws << " " << S[s].we << " " << S[s].z1 << " " << S[s].z2 << " " << S[s].st << " " << S[s].ss << std::endl;
+                    if (S[s].inst == 0) {
+                        nSect += 1;
+                        nWall += S[s].we - S[s].ws;
+                    }
+                }
+                fp << nSect << std::endl;
+                for (int s = 0, ws = 0; s < numSect; s++) {
+                    if (S[s].inst == 0) {
+                        saveSector( S[s], ws );
+                        ws += S[s].we - S[s].ws;
+                    }
                 }
                 // wall data
-                fp << numWall << std::endl;
-                for (int w = 0; w < numWall; w++) {
-                    fp << W[w].x1 << " " << W[w].y1 << " " << W[w].x2 << " " << W[w].y2 << " " << W[w].wt << " " << W[w].u << " " << W[w].v << " " << W[w].shade << std::endl;
+                fp << nWall << std::endl;
+                for (int s = 0; s < numSect; s++) {
+                    for (int w = S[s].ws; w < S[s].we && S[s].inst == 0; w++) {
+                        saveWall( W[w] );
+                    }
                 }
                 // player position
                 fp << std::endl << P.x << " " << P.y << " " << P.z << " " << P.a << " " << P.l << std::endl;
+                // prefabs and the instances that are left
+                if (!Prefabs.empty()) {
+                    fp << std::endl << "prefabs " << Prefabs.size() << std::endl;
+                    for (const Prefab &pf : Prefabs) {
+                        fp << pf.vSect.size() << " " << pf.vWall.size() << std::endl;
+                        for (const Sector &ps : pf.vSect) {
+                            saveSector( ps, ps.ws );
+                        }
+                        for (const Wall &pw : pf.vWall) {
+                            saveWall( pw );
+                        }
+                    }
+                    int nInst = int( std::count_if( Instances.begin(), Instances.end(), []( const Instance &in ) { return in.prefab >= 0; } ));
+                    fp << "instances " << nInst << std::endl;
+                    for (const Instance &in : Instances) {
+                        if (in.prefab >= 0) {
+                            fp << in.prefab << " " << in.x << " " << in.y << " " << in.z << " " << in.turn << " " << int( in.bMirror ) << std::endl;
+                        }
+                    }
+                }
             }
             fp.close();
         }
     }
 
-    // load file data into S (sector data), W (wall data) and P (player data)
-    void load() {
-        std::ifstream fp( LEVEL_FILE );
+    // load file data into S (sector data), W (wall data) and P (player data). The file is read and checked
+    // completely before anything is replaced: a file that is cut short, has counts beyond MAX_SECT / MAX_WALL,
+    // sectors with walls that don't exist or textures that don't exist is rejected, and the current level stays
+    bool load( const std::string &sFile = LEVEL_FILE ) {
+        std::ifstream fp( sFile );
         if(!fp.is_open()) {
-            std::cout << "ERROR: load() --> Error opening file: " << LEVEL_FILE << std::endl;
-            return;
-        } else {
-            fp >> numSect;
-            for(int s = 0; s < numSect; s++) { //load all sectors
-                fp >> S[s].ws >> S[s].we >> S[s].z1 >> S[s].z2 >> S[s].st >> S[s].ss;
+            std::cout << "ERROR: load() --> Error opening file: " << sFile << std::endl;
+            return false;
+        }
+        // the first failed check is reported
+        std::string sError;
+        auto check = [&]( bool bOk, const char *sWhat ) {
+            if (!bOk && sError.empty()) {
+                sError = sWhat;
             }
-            fp >> numWall;
-            for(int w = 0; w < numWall; w++) { //load all walls
-                fp >> W[w].x1 >> W[w].y1 >> W[w].x2 >> W[w].y2 >> W[w].wt >> W[w].u >> W[w].v >> W[w].shade;
+            return sError.empty();
+        };
+        auto loadSector = [&]( Sector &sect ) {
+            sect = Sector();
+            fp >> sect.ws >> sect.we >> sect.z1 >> sect.z2 >> sect.st >> sect.ss;
+            return check( !fp.fail(), "sector data" ) &&
+                   check( sect.st >= 0 && sect.st <= numText && sect.ss >= 1, "sector texture" );
+        };
+        auto loadWall = [&]( Wall &wall ) {
+            fp >> wall.x1 >> wall.y1 >> wall.x2 >> wall.y2 >> wall.wt >> wall.u >> wall.v >> wall.shade;
+            return check( !fp.fail(), "wall data" ) &&
+                   check( wall.wt >= 0 && wall.wt <= numText && wall.u >= 1 && wall.v >= 1, "wall texture" );
+        };
+        // the walls of the sectors, known once the walls that follow them are read
+        auto checkRanges = [&]( const std::vector<Sector> &vSect, int nWall ) {
+            for (const Sector &sect : vSect) {
+                if (!check( sect.ws >= 0 && sect.ws < sect.we && sect.we <= nWall, "sector wall range" )) {
+                    return false;
+                }
             }
-            fp >> P.x >> P.y >> P.z >> P.a >> P.l;
-            fp.close();
+            return true;
+        };
+        auto loadCount = [&]( int nMax, const char *sWhat ) {
+            int n = 0;
+            fp >> n;
+            return check( !fp.fail() && n >= 0 && n <= nMax, sWhat ) ? n : 0;
+        };
+
+        std::vector<Sector> vSect( loadCount( MAX_SECT, "number of sectors" ));
+        for (size_t s = 0; s < vSect.size() && loadSector( vSect[s] ); s++) {}
+        std::vector<Wall> vWall( sError.empty() ? loadCount( MAX_WALL, "number of walls" ) : 0 );
+        for (size_t w = 0; w < vWall.size() && loadWall( vWall[w] ); w++) {}
+        checkRanges( vSect, int( vWall.size()));
+        Player p = P;
+        if (sError.empty()) {
+            fp >> p.x >> p.y >> p.z >> p.a >> p.l;
+            check( !fp.fail(), "player data" );
+            p.a = (p.a % 360 + 360) % 360;
+        }
+        // optional: prefabs, and the instances to expand after the sectors of the level
+        std::vector<Prefab> vPrefabs;
+        std::vector<Instance> vInstances;
+        std::string sTag;
+        if (sError.empty() && fp >> sTag) {
+            check( sTag == "prefabs", "section" );
+            vPrefabs.resize( loadCount( MAX_SECT, "number of prefabs" ));
+            for (size_t i = 0; i < vPrefabs.size() && sError.empty(); i++) {
+                Prefab &pf = vPrefabs[i];
+                pf.vSect.resize( loadCount( MAX_SECT, "prefab sectors" ));
+                pf.vWall.resize( loadCount( MAX_WALL, "prefab walls"   ));
+                for (size_t s = 0; s < pf.vSect.size() && loadSector( pf.vSect[s] ); s++) {}
+                for (size_t w = 0; w < pf.vWall.size() && loadWall( pf.vWall[w] ); w++) {}
+                checkRanges( pf.vSect, int( pf.vWall.size()));
+            }
+            if (sError.empty()) {
+                fp >> sTag;
+                check( !fp.fail() && sTag == "instances", "section" );
+                vInstances.resize( loadCount( MAX_SECT, "number of instances" ));
+            }
+            for (size_t i = 0; i < vInstances.size() && sError.empty(); i++) {
+                Instance &in = vInstances[i];
+                int nMirror = 0;
+                fp >> in.prefab >> in.x >> in.y >> in.z >> in.turn >> nMirror;
+                in.bMirror = nMirror != 0;
+                check( !fp.fail() && in.prefab >= 0 && in.prefab < int( vPrefabs.size()) && in.turn >= 0 && in.turn < 4, "instance data" );
+            }
+        }
+        fp.close();
+        if (!sError.empty()) {
+            std::cout << "ERROR: load() --> bad " << sError << " in file: " << sFile << std::endl;
+            return false;
         }
+
+        numSect = int( vSect.size());
+        numWall = int( vWall.size());
+        std::copy( vSect.begin(), vSect.end(), S );
+        std::copy( vWall.begin(), vWall.end(), W );
+        P = p;
+        Prefabs   = vPrefabs;
+        Instances = vInstances;
+        for (int i = 0; i < int( Instances.size()); i++) {
+            if (!appendInstance( i )) {
+                Instances[i].prefab = -1;
+            }
+        }
+        nPrefab = 0;
+        // the stored shades are not trusted, they go stale when a level is edited by hand
+        shadeWalls( nullptr, numWall );
+        VT.build( S, numSect, W );
+        clearSelection();
+        V.nGeometry += 1;
+        return true;
     }
 
     // set all members of the Grid struct type G (global variable) to initial values
@@ -198,25 +1274,333 @@ private:
         Draw( x, SH - 1 - y, olc::Pixel( r, g, b ));
     }
 
-    void drawLine( float x1, float y1, float x2, float y2, int r, int g, int b ) {
-        float dx = x2 - x1;
-        float dy = y2 - y1;
-        float fLarge = std::max( fabs( dx ), fabs( dy ));
-        dx /= fLarge;
-        dy /= fLarge;
-        for(int n = 0; n < fLarge; n++) {
-            drawPixel( x1, y1, r, g, b );
-            x1 += dx;
-            y1 += dy;
+    // the part of the screen lines are clipped against - the 2D grid area
+    ClipRect rView = { 0, 0, GRID_W - 1, SH - 1 };
+
+    // Cohen-Sutherland region codes
+    enum { CS_INSIDE = 0, CS_LEFT = 1, CS_RIGHT = 2, CS_BOTTOM = 4, CS_TOP = 8 };
+
+    int outCode( int x, int y, const ClipRect &r ) {
+        int code = CS_INSIDE;
+        if      (x < r.xmin) { code |= CS_LEFT;   }
+        else if (x > r.xmax) { code |= CS_RIGHT;  }
+        if      (y < r.ymin) { code |= CS_BOTTOM; }
+        else if (y > r.ymax) { code |= CS_TOP;    }
+        return code;
+    }
+
+    // Cohen-Sutherland clipping of segment (x1, y1)-(x2, y2) against r. The clipped end points are
+    // rounded, so they are only an estimate of where the rasterized line enters/leaves r.
+    // Returns false if the segment is completely outside r.
+    bool clipLine( int &x1, int &y1, int &x2, int &y2, const ClipRect &r ) {
+        int code1 = outCode( x1, y1, r );
+        int code2 = outCode( x2, y2, r );
+        while (true) {
+            if (!(code1 | code2)) { return true;  }   // trivial accept
+            if (  code1 & code2 ) { return false; }   // trivial reject
+            int code = code1 ? code1 : code2;
+            long long dx = x2 - x1, dy = y2 - y1;
+            int x, y;
+            if (code & CS_TOP) {
+                x = x1 + int( dx * (r.ymax - y1) / dy ); y = r.ymax;
+            } else if (code & CS_BOTTOM) {
+                x = x1 + int( dx * (r.ymin - y1) / dy ); y = r.ymin;
+            } else if (code & CS_RIGHT) {
+                y = y1 + int( dy * (r.xmax - x1) / dx ); x = r.xmax;
+            } else {
+                y = y1 + int( dy * (r.xmin - x1) / dx ); x = r.xmin;
+            }
+            if (code == code1) { x1 = x; y1 = y; code1 = outCode( x1, y1, r ); }
+            else               { x2 = x; y2 = y; code2 = outCode( x2, y2, r ); }
         }
     }
 
-    // number patches are 12 pixels wide and 5 pixels high
-    void drawNumber( int nx, int ny, int n ) {
-        int nCharW = 12;
-        int nCharH =  5;
-        for(int y = 0; y < nCharH; y++) {
-            int y2 = ((nCharH - 1 - y) + nCharH * n) * 3 * nCharW;
+    // integer Bresenham line from (x1, y1) to (x2, y2) inclusive, clipped against r, written directly into
+    // the draw target. Clipping only changes which steps are taken, not where the pixels land, so the
+    // visible part of a line is identical whatever the clip rectangle is.
+    void rasterLine( int x1, int y1, int x2, int y2, olc::Pixel col, const ClipRect &r ) {
+        olc::Sprite *pTarget = GetDrawTarget();
+        // (2D) line coordinates have their origin at the lower left of the screen
+        auto plot = [&]( int x, int y ) {
+            pTarget->GetData()[(SH - 1 - y) * pTarget->width + x] = col;
+        };
+        auto inside = [&]( int x, int y ) {
+            return x >= r.xmin && x <= r.xmax && y >= r.ymin && y <= r.ymax;
+        };
+        // degenerate (zero length) wall - just a dot
+        if (x1 == x2 && y1 == y2) {
+            if (inside( x1, y1 )) { plot( x1, y1 ); }
+            return;
+        }
+        // work on the major axis (a) and minor axis (b) so that both octant halves share the code
+        int adx = abs( x2 - x1 ), sx = x2 < x1 ? -1 : 1;
+        int ady = abs( y2 - y1 ), sy = y2 < y1 ? -1 : 1;
+        bool bXMajor = adx >= ady;
+        int nMaj = bXMajor ? adx : ady;
+        int nMin = bXMajor ? ady : adx;
+        // pixel at step i is (major: i, minor: (2 * i * nMin + nMaj) / (2 * nMaj))
+        auto pixelAt = [&]( int i, int &x, int &y ) {
+            int off = int( (2LL * i * nMin + nMaj) / (2LL * nMaj) );
+            x = x1 + sx * (bXMajor ? i   : off);
+            y = y1 + sy * (bXMajor ? off : i  );
+        };
+        auto stepInside = [&]( int i ) {
+            int x, y;
+            pixelAt( i, x, y );
+            return inside( x, y );
+        };
+
+        int i0 = 0, i1 = nMaj;
+        if (outCode( x1, y1, r ) | outCode( x2, y2, r )) {
+            // clip against r grown by a margin, so that the rounding in clipLine() can never reject pixels
+            // of the line that are inside r
+            ClipRect rGrown = { r.xmin - 2, r.ymin - 2, r.xmax + 2, r.ymax + 2 };
+            int cx1 = x1, cy1 = y1, cx2 = x2, cy2 = y2;
+            if (!clipLine( cx1, cy1, cx2, cy2, rGrown )) {
+                return;
+            }
+            // convert the clipped end points to a step range along the major axis
+            i0 = std::clamp( bXMajor ? (cx1 - x1) * sx : (cy1 - y1) * sy, 0, nMaj );
+            i1 = std::clamp( bXMajor ? (cx2 - x1) * sx : (cy2 - y1) * sy, 0, nMaj );
+            // the estimate may be a few steps off: the line's pixels inside r form one contiguous run, so
+            // nudge the ends until they exactly bound it
+            while (i0 <= i1 && !stepInside( i0 )) { i0++; }
+            while (i0 >  0  &&  stepInside( i0 - 1 )) { i0--; }
+            while (i1 >= i0 && !stepInside( i1 )) { i1--; }
+            while (i1 < nMaj && stepInside( i1 + 1 )) { i1++; }
+            if (i0 > i1) {
+                return;
+            }
+        }
+
+        // set up the Bresenham error term at step i0 and run
+        olc::Pixel *pBuf = pTarget->GetData();
+        int nPitch = pTarget->width;
+        int nStepMaj = bXMajor ? sx : -sy * nPitch;   // buffer rows run top down, y runs bottom up
+        int nStepMin = bXMajor ? -sy * nPitch : sx;
+        long long num = 2LL * i0 * nMin + nMaj;
+        int err = int( num % (2LL * nMaj) );
+        int x, y;
+        pixelAt( i0, x, y );
+        int nOffset = (SH - 1 - y) * nPitch + x;
+        for (int i = i0; i <= i1; i++) {
+            pBuf[nOffset] = col;
+            nOffset += nStepMaj;
+            err += 2 * nMin;
+            if (err >= 2 * nMaj) {
+                err -= 2 * nMaj;
+                nOffset += nStepMin;
+            }
+        }
+    }
+
+    void drawLine( int x1, int y1, int x2, int y2, int r, int g, int b ) {
+        rasterLine( x1, y1, x2, y2, olc::Pixel( r, g, b ), rView );
+    }
+
+    std::vector<LineSeg> vWallLines;   // walls of the current frame, collected by draw2D()
+    std::vector<LineSeg> vLodPoints;   // sectors that collapsed into a single pixel, collected by draw2D()
+    bool bAntiAlias = false;           // draw the walls anti aliased (toggle with L)
+
+    // batch version of drawLine(): draws all segments in one call
+    void drawLines( const LineSeg *pLines, int nLines ) {
+        for (int i = 0; i < nLines; i++) {
+            const LineSeg &l = pLines[i];
+            rasterLine( l.x1, l.y1, l.x2, l.y2, l.col, rView );
+        }
+    }
+
+    // scratch buffers for drawLineAA(), sized for the longest clipped line. One per thread
+    typedef struct {
+        std::vector<int> vMinor, vWeight, vCov;
+        std::vector<olc::Pixel *> vPix;
+        olc::Pixel pixDummy;           // masked samples are blended into this one
+    } AAScratch;
+    std::vector<AAScratch> vAAScratch = std::vector<AAScratch>( 1 );
+
+    // blend nSamples pixels towards col, with coverages in [0, 256]
+    void blendSamples( olc::Pixel **pPix, const int *pCov, int nSamples, olc::Pixel col ) {
+        int i = 0;
+#ifdef GRID2D_SSE2
+        // four pixels per iteration: res = (src * cov + dst * (256 - cov)) >> 8 per channel, in 16 bit lanes
+        __m128i vZero = _mm_setzero_si128();
+        __m128i vSrc  = _mm_unpacklo_epi8( _mm_set1_epi32( int( col.n )), vZero );
+        __m128i v256  = _mm_set1_epi16( 256 );
+        for (; i + 4 <= nSamples; i += 4) {
+            __m128i vDst = _mm_set_epi32( int( pPix[i + 3]->n ), int( pPix[i + 2]->n ), int( pPix[i + 1]->n ), int( pPix[i]->n ));
+            __m128i vCov = _mm_loadu_si128( (const __m128i *)&pCov[i] );
+            vCov = _mm_packs_epi32( vCov, vCov );            // c0 c1 c2 c3 c0 c1 c2 c3
+            vCov = _mm_unpacklo_epi16( vCov, vCov );         // c0 c0 c1 c1 c2 c2 c3 c3
+            __m128i vCovLo = _mm_unpacklo_epi32( vCov, vCov );   // c0 x 4, c1 x 4
+            __m128i vCovHi = _mm_unpackhi_epi32( vCov, vCov );   // c2 x 4, c3 x 4
+            __m128i vDstLo = _mm_unpacklo_epi8( vDst, vZero );
+            __m128i vDstHi = _mm_unpackhi_epi8( vDst, vZero );
+            __m128i vResLo = _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( vSrc, vCovLo ), _mm_mullo_epi16( vDstLo, _mm_sub_epi16( v256, vCovLo ))), 8 );
+            __m128i vResHi = _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( vSrc, vCovHi ), _mm_mullo_epi16( vDstHi, _mm_sub_epi16( v256, vCovHi ))), 8 );
+            alignas( 16 ) uint32_t aRes[4];
+            _mm_store_si128( (__m128i *)aRes, _mm_packus_epi16( vResLo, vResHi ));
+            pPix[i    ]->n = aRes[0];
+            pPix[i + 1]->n = aRes[1];
+            pPix[i + 2]->n = aRes[2];
+            pPix[i + 3]->n = aRes[3];
+        }
+#endif
+        for (; i < nSamples; i++) {
+            olc::Pixel &p = *pPix[i];
+            int c = pCov[i];
+            p.r = uint8_t( (col.r * c + p.r * (256 - c)) >> 8 );
+            p.g = uint8_t( (col.g * c + p.g * (256 - c)) >> 8 );
+            p.b = uint8_t( (col.b * c + p.b * (256 - c)) >> 8 );
+            p.a = uint8_t( (col.a * c + p.a * (256 - c)) >> 8 );
+        }
+    }
+
+    // anti aliased (Xiaolin Wu) version of rasterLine(). The coverage of all visible steps is computed four
+    // steps at a time, and the resulting samples are then blended four pixels at a time. Within one segment
+    // all samples hit different pixels, so a batch never reads a stale pixel. As with rasterLine(), the
+    // clip rectangle doesn't change the pixels that are drawn
+    void drawLineAA( const LineSeg &l, const ClipRect &r, AAScratch &scr ) {
+        olc::Sprite *pTarget = GetDrawTarget();
+        olc::Pixel *pBuf = pTarget->GetData();
+        int nPitch = pTarget->width;
+
+        if (l.x1 == l.x2 && l.y1 == l.y2) {
+            if (l.x1 >= r.xmin && l.x1 <= r.xmax && l.y1 >= r.ymin && l.y1 <= r.ymax) {
+                pBuf[(SH - 1 - l.y1) * nPitch + l.x1] = l.col;
+            }
+            return;
+        }
+        bool bXMajor = abs( l.x2 - l.x1 ) >= abs( l.y2 - l.y1 );
+        int nMaj0 = bXMajor ? l.x1 : l.y1, nMajD = bXMajor ? l.x2 - l.x1 : l.y2 - l.y1;
+        int nMin0 = bXMajor ? l.y1 : l.x1, nMinD = bXMajor ? l.y2 - l.y1 : l.x2 - l.x1;
+        int nMaj = abs( nMajD ), sMaj = nMajD < 0 ? -1 : 1;
+        float fGrad = float( nMinD ) / float( nMaj );
+
+        // estimate the visible step range, pad it for the +/- 1 pixel band, then cut it exactly on the major axis
+        ClipRect rGrown = { r.xmin - 2, r.ymin - 2, r.xmax + 2, r.ymax + 2 };
+        int cx1 = l.x1, cy1 = l.y1, cx2 = l.x2, cy2 = l.y2;
+        if (!clipLine( cx1, cy1, cx2, cy2, rGrown )) {
+            return;
+        }
+        int nMajLo = bXMajor ? r.xmin : r.ymin, nMajHi = bXMajor ? r.xmax : r.ymax;
+        int i0 = ((bXMajor ? cx1 : cy1) - nMaj0) * sMaj - 2;
+        int i1 = ((bXMajor ? cx2 : cy2) - nMaj0) * sMaj + 2;
+        i0 = std::max( { i0, 0, sMaj > 0 ? nMajLo - nMaj0 : nMaj0 - nMajHi } );
+        i1 = std::min( { i1, nMaj, sMaj > 0 ? nMajHi - nMaj0 : nMaj0 - nMajLo } );
+        int nSteps = i1 - i0 + 1;
+        if (nSteps <= 0) {
+            return;
+        }
+        if (int( scr.vMinor.size()) < nSteps) {
+            scr.vMinor.resize( nSteps );
+            scr.vWeight.resize( nSteps );
+            scr.vCov.resize( 2 * nSteps );
+            scr.vPix.resize( 2 * nSteps );
+        }
+
+        // coverage: minor coordinate t = nMin0 + i * fGrad, split into integer part and 8 bit fraction
+        int i = i0;
+#ifdef GRID2D_SSE2
+        __m128 vGrad  = _mm_set1_ps( fGrad );
+        __m128 vStart = _mm_set1_ps( float( nMin0 ));
+        __m128 vBias  = _mm_set1_ps( 1024.0f );   // keeps t positive, so truncation == floor
+        for (; i + 3 <= i1; i += 4) {
+            __m128  vI    = _mm_add_ps( _mm_set1_ps( float( i )), _mm_set_ps( 3.0f, 2.0f, 1.0f, 0.0f ));
+            __m128  vT    = _mm_add_ps( vStart, _mm_mul_ps( vI, vGrad ));
+            __m128i vFl   = _mm_sub_epi32( _mm_cvttps_epi32( _mm_add_ps( vT, vBias )), _mm_set1_epi32( 1024 ));
+            __m128  vFrac = _mm_sub_ps( vT, _mm_cvtepi32_ps( vFl ));
+            _mm_storeu_si128( (__m128i *)&scr.vMinor [i - i0], vFl );
+            _mm_storeu_si128( (__m128i *)&scr.vWeight[i - i0], _mm_cvtps_epi32( _mm_mul_ps( vFrac, _mm_set1_ps( 256.0f ))));
+        }
+#endif
+        for (; i <= i1; i++) {
+            float fT = float( nMin0 ) + float( i ) * fGrad;
+            int nFl = int( fT + 1024.0f ) - 1024;
+            scr.vMinor [i - i0] = nFl;
+            scr.vWeight[i - i0] = int( std::lrint( (fT - float( nFl )) * 256.0f ));
+        }
+
+        // two samples per step, samples outside the clip rectangle are redirected to a dummy pixel
+        int nMinLo = bXMajor ? r.ymin : r.xmin, nMinHi = bXMajor ? r.ymax : r.xmax;
+        for (int k = 0; k < nSteps; k++) {
+            int nMajor = nMaj0 + sMaj * (i0 + k);
+            for (int j = 0; j < 2; j++) {
+                int nMinor = scr.vMinor[k] + j;
+                int nCov   = j == 0 ? 256 - scr.vWeight[k] : scr.vWeight[k];
+                if (nMinor < nMinLo || nMinor > nMinHi) {
+                    scr.vPix[2 * k + j] = &scr.pixDummy;
+                } else {
+                    int x = bXMajor ? nMajor : nMinor;
+                    int y = bXMajor ? nMinor : nMajor;
+                    scr.vPix[2 * k + j] = &pBuf[(SH - 1 - y) * nPitch + x];
+                }
+                scr.vCov[2 * k + j] = nCov;
+            }
+        }
+        blendSamples( scr.vPix.data(), scr.vCov.data(), 2 * nSteps, l.col );
+    }
+
+    void drawLinesAA( const LineSeg *pLines, int nLines ) {
+        for (int i = 0; i < nLines; i++) {
+            drawLineAA( pLines[i], rView, vAAScratch[0] );
+        }
+    }
+
+    // tiled rasterization: the view is split into TILE_SIZE x TILE_SIZE tiles, and lines are binned per tile
+    // on their bounding box. Each tile draws its lines in batch order, clipped to the tile, which gives the
+    // same pixels as drawing the whole batch in one go. Tiles don't overlap, so they can be drawn in parallel
+    #define TILE_SIZE       32
+    #define TILE_MIN_LINES  1024       // below this batch size threading doesn't pay off
+    WorkerPool *pPool = nullptr;
+    bool bThreaded = true;             // use the worker pool for large batches (toggle with T)
+    std::vector<std::vector<int>> vTileBins;
+
+    void drawLinesTiled( const LineSeg *pLines, int nLines, bool bAA ) {
+        if (!bThreaded || nLines < TILE_MIN_LINES || pPool->threads() < 2) {
+            if (bAA) { drawLinesAA( pLines, nLines ); }
+            else     { drawLines(   pLines, nLines ); }
+            return;
+        }
+        int nTilesX = (rView.xmax - rView.xmin) / TILE_SIZE + 1;
+        int nTilesY = (rView.ymax - rView.ymin) / TILE_SIZE + 1;
+        vTileBins.resize( nTilesX * nTilesY );
+        for (std::vector<int> &vBin : vTileBins) {
+            vBin.clear();
+        }
+        // AA lines reach one pixel beyond their bounding box on the minor axis
+        int nPad = bAA ? 1 : 0;
+        for (int i = 0; i < nLines; i++) {
+            const LineSeg &l = pLines[i];
+            int tx1 = (std::clamp( std::min( l.x1, l.x2 ) - nPad, rView.xmin, rView.xmax + 1 ) - rView.xmin) / TILE_SIZE;
+            int tx2 = (std::clamp( std::max( l.x1, l.x2 ) + nPad, rView.xmin - 1, rView.xmax ) - rView.xmin) / TILE_SIZE;
+            int ty1 = (std::clamp( std::min( l.y1, l.y2 ) - nPad, rView.ymin, rView.ymax + 1 ) - rView.ymin) / TILE_SIZE;
+            int ty2 = (std::clamp( std::max( l.y1, l.y2 ) + nPad, rView.ymin - 1, rView.ymax ) - rView.ymin) / TILE_SIZE;
+            for (int ty = ty1; ty <= ty2 && ty < nTilesY; ty++) {
+                for (int tx = tx1; tx <= tx2 && tx < nTilesX; tx++) {
+                    vTileBins[ty * nTilesX + tx].push_back( i );
+                }
+            }
+        }
+        vAAScratch.resize( pPool->threads() );
+        pPool->run( nTilesX * nTilesY, [&]( int nTile, int nThread ) {
+            int tx = nTile % nTilesX, ty = nTile / nTilesX;
+            ClipRect rTile = { rView.xmin + tx * TILE_SIZE, rView.ymin + ty * TILE_SIZE, 0, 0 };
+            rTile.xmax = std::min( rTile.xmin + TILE_SIZE - 1, rView.xmax );
+            rTile.ymax = std::min( rTile.ymin + TILE_SIZE - 1, rView.ymax );
+            for (int i : vTileBins[nTile]) {
+                const LineSeg &l = pLines[i];
+                if (bAA) { drawLineAA( l, rTile, vAAScratch[nThread] ); }
+                else     { rasterLine( l.x1, l.y1, l.x2, l.y2, l.col, rTile ); }
+            }
+        } );
+    }
+
+    // number patches are 12 pixels wide and 5 pixels high
+    void drawNumber( int nx, int ny, int n ) {
+        int nCharW = 12;
+        int nCharH =  5;
+        for(int y = 0; y < nCharH; y++) {
+            int y2 = ((nCharH - 1 - y) + nCharH * n) * 3 * nCharW;
             for(int x = 0; x < nCharW; x++) {
                 int x2 = x * 3;
                 if(T_NUMBERS[y2 + x2] == 0) {
@@ -227,275 +1611,1303 @@ private:
         }
     }
 
-    void draw2D() {
-        int c;
-        // draw background using the T_VIEW2D sprite
+    // draw background: the grid lines are generated for the current view, the button column is taken
+    // from the T_VIEW2D sprite
+    void drawBackground() {
+        // a grid line every 32 world units and a major one every 64 (on the odd lines horizontally, like
+        // the T_VIEW2D sprite), thinned out by factors of two when zoomed out
+        int nStep = 32;
+        while (nStep < 4.0f * VP.scale) {
+            nStep *= 2;
+        }
+        // 0 = no line, 1 = minor line, 2 = major line in the column / row
+        auto gridLine = [=]( float w0, float w1, int nMajorParity ) {
+            double m = ceil( w0 / nStep );
+            if (m * nStep >= w1) {
+                return 0;
+            }
+            return (((long long)m & 1) == nMajorParity) ? 2 : 1;
+        };
+        olc::Pixel aGridCol[3] = { olc::Pixel( 36, 77, 64 ), olc::Pixel( 37, 41, 40 ), olc::Pixel( 2, 2, 2 ) };
+        std::vector<int> aColLine( GRID_W );
+        for (int x = 0; x < GRID_W; x++) {
+            aColLine[x] = gridLine( screenToWorldX( x ), screenToWorldX( x + 1 ), 0 );
+        }
+        for (int y = 0; y < SH; y++) {
+            int nRowLine = gridLine( screenToWorldY( y ), screenToWorldY( y + 1 ), 1 );
+            for (int x = 0; x < GRID_W; x++) {
+                int c = std::max( nRowLine, aColLine[x] );
+                drawPixel( x, y, aGridCol[c].r, aGridCol[c].g, aGridCol[c].b );
+            }
+        }
+        // the button column is at the top, below it the screen is filled with the color of its bottom row
         for(int y = 0; y < SH; y++) {
-            int y2 = (SH - 1 - y) * 3 * SW; //invert height, x3 for rgb, x15 for texture width
-            for(int x = 0; x < SW; x++) {
-                int pixel = x * 3 + y2;
+            int nRow = std::min( SH - 1 - y, BUTTONS_H - 1 );   // sprite rows are top down
+            int y2 = nRow * 3 * T_VIEW2D_WIDTH; //x3 for rgb
+            for(int x = 0; x < BUTTONS_W; x++) {
+                int pixel = (x + T_VIEW2D_WIDTH - BUTTONS_W) * 3 + y2;
                 int r = T_VIEW2D[pixel + 0];
                 int g = T_VIEW2D[pixel + 1];
                 int b = T_VIEW2D[pixel + 2];
-                // what are the magic numbers below?
-                if(G.addSect > 0 && y > 48 - 8 && y < 56 - 8 && x > 144) {
-                    r = r >> 1;    // darken sector button (by halfing rgb values )
-                    g = g >> 1;
-                    b = b >> 1;
-                }
-                drawPixel( x, y, r, g, b );
-            }
-        }
-        // draw sectors
-        for (int s = 0; s < numSect; s++) {              // iterate all sectors
-            for (int w = S[s].ws; w < S[s].we; w++) {    // iterate all walls for one sector
-                if (s == G.selS - 1) {                   // if this sector is selected
-                    // set sector to globals
-                    S[G.selS - 1].z1 = G.z1;
-                    S[G.selS - 1].z2 = G.z2;
-                    S[G.selS - 1].st = G.st;
-                    S[G.selS - 1].ss = G.ss;
-                    // yellow select
-                    if(G.selW == 0) {
-                        c = 80;                          // all walls yellow
-                    } else if(G.selW + S[s].ws - 1 == w) {
-                        c = 80;                          //one wall selected
-                        W[w].wt = G.wt;
-                        W[w].u  = G.wu;
-                        W[w].v  = G.wv;
-                    } else {
-                        c = 0;                           //grey walls
+                drawPixel( x + GRID_W, y, r, g, b );
+            }
+        }
+    }
+
+    // world <-> logical pixel (origin lower left) transforms of the 2D view. Screen coordinates are
+    // clamped, so that walls far outside the view don't overflow the rasterizer
+    int worldToScreenX( int wx ) { return int( std::clamp( floorf( (wx - VP.x) / VP.scale ), -1.0e8f, 1.0e8f )); }
+    int worldToScreenY( int wy ) { return int( std::clamp( floorf( (wy - VP.y) / VP.scale ), -1.0e8f, 1.0e8f )); }
+    float screenToWorldX( float sx ) { return VP.x + sx * VP.scale; }
+    float screenToWorldY( float sy ) { return VP.y + sy * VP.scale; }
+
+    void initView() {
+        VP.x = 0.0f;
+        VP.y = 0.0f;
+        VP.scale = float( G.scale );
+        V.nView += 1;
+    }
+
+    // spatial index over the sector bounding boxes, used to keep the work of the 2D view bounded by what is
+    // on screen. Level 0 lists the sectors per cell of LOD_CELL world units, level k > 0 only records which
+    // cells of (LOD_CELL << k) units contain small sectors, which are drawn as single points at far zoom
+    #define LOD_SHIFT    8
+    #define LOD_CELL     (1 << LOD_SHIFT)
+    #define LOD_LEVELS   16
+    std::vector<BBox> vSectBox;                                  // per sector bounding box
+    std::vector<int> vSectBySize;                                // sectors, largest bounding box first
+    std::unordered_map<long long, std::vector<int>> mapLodCells;
+    std::unordered_map<long long, int> mapLodOccupied[LOD_LEVELS];   // number of small sectors per cell
+    int nLodGeometry = -1;                                       // geometry version the index was built at
+    std::vector<int> vSectStamp;                                 // to visit sectors that span cells only once
+    int nStamp = 0;
+
+    long long cellKey( int cx, int cy ) { return (long long)( (unsigned long long)(unsigned int)cx << 32 | (unsigned int)cy ); }
+
+    int sectExtent( int s ) { return std::max( vSectBox[s].x2 - vSectBox[s].x1, vSectBox[s].y2 - vSectBox[s].y1 ); }
+
+    // bounding box of the walls of sector s
+    BBox sectorBox( int s ) {
+        BBox b = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+        for (int w = S[s].ws; w < S[s].we; w++) {
+            b.x1 = std::min( { b.x1, W[w].x1, W[w].x2 } );
+            b.y1 = std::min( { b.y1, W[w].y1, W[w].y2 } );
+            b.x2 = std::max( { b.x2, W[w].x1, W[w].x2 } );
+            b.y2 = std::max( { b.y2, W[w].y1, W[w].y2 } );
+        }
+        if (S[s].we <= S[s].ws) {
+            b = { 0, 0, 0, 0 };
+        }
+        return b;
+    }
+
+    // add sector s to the cells of its bounding box (nAdd = 1), or remove it from them (nAdd = -1). The
+    // sectors of a cell are kept in order, as building the index puts them
+    void lodSector( int s, int nAdd ) {
+        const BBox &b = vSectBox[s];
+        for (int cy = b.y1 >> LOD_SHIFT; cy <= b.y2 >> LOD_SHIFT; cy++) {
+            for (int cx = b.x1 >> LOD_SHIFT; cx <= b.x2 >> LOD_SHIFT; cx++) {
+                std::vector<int> &vCell = mapLodCells[cellKey( cx, cy )];
+                auto it = std::lower_bound( vCell.begin(), vCell.end(), s );
+                if (nAdd > 0) {
+                    vCell.insert( it, s );
+                } else if (it != vCell.end() && *it == s) {
+                    vCell.erase( it );
+                }
+                if (vCell.empty()) {
+                    mapLodCells.erase( cellKey( cx, cy ));
+                }
+            }
+        }
+        int nExtent = sectExtent( s );
+        int mx = b.x1 + (b.x2 - b.x1) / 2, my = b.y1 + (b.y2 - b.y1) / 2;
+        for (int k = 1; k < LOD_LEVELS; k++) {
+            if (nExtent < (LOD_CELL << k)) {
+                long long nKey = cellKey( mx >> (LOD_SHIFT + k), my >> (LOD_SHIFT + k) );
+                if ((mapLodOccupied[k][nKey] += nAdd) <= 0) {
+                    mapLodOccupied[k].erase( nKey );
+                }
+            }
+        }
+    }
+
+    void buildLodIndex() {
+        vSectBox.resize( numSect );
+        vSectBySize.resize( numSect );
+        vSectStamp.assign( numSect, 0 );
+        nStamp = 0;
+        mapLodCells.clear();
+        for (int k = 0; k < LOD_LEVELS; k++) {
+            mapLodOccupied[k].clear();
+        }
+        for (int s = 0; s < numSect; s++) {
+            vSectBox[s] = sectorBox( s );
+            lodSector( s, 1 );
+            vSectBySize[s] = s;
+        }
+        std::sort( vSectBySize.begin(), vSectBySize.end(), [&]( int a, int b ) { return sectExtent( a ) > sectExtent( b ); } );
+        nLodGeometry = V.nGeometry;
+    }
+
+    // the walls of sector s were moved without a new geometry version (dragging a point): move it in the LOD
+    // index, and have orderSectors() update its distance, instead of building both again
+    void sectorMoved( int s ) {
+        if (s < 0 || s >= numSect) {
+            return;
+        }
+        if (nLodGeometry == V.nGeometry && int( vSectBox.size()) == numSect) {
+            int nExtent = sectExtent( s );
+            lodSector( s, -1 );
+            vSectBox[s] = sectorBox( s );
+            lodSector( s, 1 );
+            if (sectExtent( s ) != nExtent) {
+                auto bySize = [&]( int a, int b ) { return sectExtent( a ) > sectExtent( b ); };
+                vSectBySize.erase( std::find( vSectBySize.begin(), vSectBySize.end(), s ));
+                vSectBySize.insert( std::upper_bound( vSectBySize.begin(), vSectBySize.end(), s, bySize ), s );
+            }
+        }
+        if (s < int( vOrderStamp.size())) {
+            vOrderStamp[s] = nOrderSerial - 1;
+            bOrderStale = true;
+        }
+    }
+
+    // walls that change frequently are drawn in the dynamic layer: the walls of the selected sector,
+    // the sector that is being added, and walls that are being dragged
+    bool isDynamicWall( int s, int w ) {
+        return s == G.selS - 1 || (G.addSect == 3 && s == numSect - 1) || w == G.move[0] || w == G.move[2];
+    }
+
+    // add wall w of sector s (-1 if unknown) to the batch of lines to draw
+    void addWallLine( int s, int w ) {
+        int c;
+        if (s >= 0 && s == G.selS - 1) {         // if this sector is selected
+            // set sector to globals
+            S[G.selS - 1].z1 = G.z1;
+            S[G.selS - 1].z2 = G.z2;
+            S[G.selS - 1].st = G.st;
+            S[G.selS - 1].ss = G.ss;
+            // yellow select
+            if(G.selW == 0) {
+                c = 80;                          // all walls yellow
+            } else if(G.selW + S[s].ws - 1 == w) {
+                c = 80;                          //one wall selected
+                W[w].wt = G.wt;
+                W[w].u  = G.wu;
+                W[w].v  = G.wv;
+            } else {
+                c = 0;                           //grey walls
+            }
+        } else if (vWallSel[w]) {
+            c = 80;                              //part of the multi selection
+        } else {
+            c = 0;                               //sector not selected, grey
+        }
+        int b = (c == 0 && s >= 0 && S[s].inst > 0) ? 48 : 0;  // instances are tinted blue
+
+        vWallLines.push_back( { worldToScreenX( W[w].x1 ), worldToScreenY( W[w].y1 ), worldToScreenX( W[w].x2 ), worldToScreenY( W[w].y2 ), olc::Pixel( 128 + c - b / 2, 128 + c, 128 - c + b ) } );
+    }
+
+    // add the static walls of sector s, or a single point if it is smaller than a pixel on screen
+    void addStaticSector( int s, const BBox &bView ) {
+        const BBox &b = vSectBox[s];
+        if (b.x2 < bView.x1 || b.x1 > bView.x2 || b.y2 < bView.y1 || b.y1 > bView.y2) {
+            return;
+        }
+        if (sectExtent( s ) < VP.scale) {
+            int x = worldToScreenX( b.x1 + (b.x2 - b.x1) / 2 ), y = worldToScreenY( b.y1 + (b.y2 - b.y1) / 2 );
+            vLodPoints.push_back( { x, y, x, y, olc::Pixel( 128, 128, 128 ) } );
+            return;
+        }
+        for (int w = S[s].ws; w < S[s].we; w++) {
+            if (!isDynamicWall( s, w )) {
+                addWallLine( s, w );
+            }
+        }
+    }
+
+    void collectStaticWalls() {
+        if (nLodGeometry != V.nGeometry || int( vSectBox.size()) != numSect) {
+            buildLodIndex();
+        }
+        // part of the world that is visible in the grid area
+        BBox bView = { int( floorf( VP.x )), int( floorf( VP.y )),
+                       int( ceilf( screenToWorldX( GRID_W ))), int( ceilf( screenToWorldY( SH ))) };
+        // pick the finest level whose cells are at least a pixel on screen
+        int k = 0;
+        while (k < LOD_LEVELS - 1 && (LOD_CELL << k) < VP.scale) {
+            k++;
+        }
+        int nShift = LOD_SHIFT + k;
+        if (k == 0) {
+            // walk the visible cells and draw the sectors in them
+            nStamp += 1;
+            for (int cy = bView.y1 >> nShift; cy <= bView.y2 >> nShift; cy++) {
+                for (int cx = bView.x1 >> nShift; cx <= bView.x2 >> nShift; cx++) {
+                    auto it = mapLodCells.find( cellKey( cx, cy ));
+                    if (it == mapLodCells.end()) {
+                        continue;
                     }
-                } else {
-                    c = 0;                               //sector not selected, grey
+                    for (int s : it->second) {
+                        if (vSectStamp[s] != nStamp) {
+                            vSectStamp[s] = nStamp;
+                            addStaticSector( s, bView );
+                        }
+                    }
+                }
+            }
+        } else {
+            // far zoom: sectors that are larger than a cell are drawn normally, each occupied cell of
+            // small sectors collapses to a single point
+            for (int s : vSectBySize) {
+                if (sectExtent( s ) < (LOD_CELL << k)) {
+                    break;
                 }
+                addStaticSector( s, bView );
+            }
+            for (int cy = bView.y1 >> nShift; cy <= bView.y2 >> nShift; cy++) {
+                for (int cx = bView.x1 >> nShift; cx <= bView.x2 >> nShift; cx++) {
+                    if (mapLodOccupied[k].count( cellKey( cx, cy ))) {
+                        int x = worldToScreenX( cx * (1 << nShift) + (1 << (nShift - 1)) );
+                        int y = worldToScreenY( cy * (1 << nShift) + (1 << (nShift - 1)) );
+                        vLodPoints.push_back( { x, y, x, y, olc::Pixel( 128, 128, 128 ) } );
+                    }
+                }
+            }
+        }
+    }
 
-                // draw the wall by drawing a line and drawing the (highlighted) end points
-                drawLine(  W[w].x1 / G.scale, W[w].y1 / G.scale, W[w].x2 / G.scale, W[w].y2 / G.scale, 128 + c, 128 + c, 128 - c );
-                drawPixel( W[w].x1 / G.scale, W[w].y1 / G.scale,                                       255    , 255    , 255     );
-                drawPixel(                                       W[w].x2 / G.scale, W[w].y2 / G.scale, 255    , 255    , 255     );
+    void collectDynamicWalls() {
+        int nSel = G.selS - 1, nAdd = G.addSect == 3 ? numSect - 1 : -1;
+        for (int s : { nSel, nAdd } ) {
+            if (s >= 0 && s < numSect && !(s == nAdd && s == nSel)) {
+                for (int w = S[s].ws; w < S[s].we; w++) {
+                    addWallLine( s, w );
+                }
             }
         }
+        // dragged walls that are not part of those sectors
+        for (int w : { G.move[0], G.move[2] == G.move[0] ? -1 : G.move[2] } ) {
+            bool bDone = w < 0;
+            for (int s : { nSel, nAdd } ) {
+                if (s >= 0 && s < numSect && w >= S[s].ws && w < S[s].we) {
+                    bDone = true;
+                }
+            }
+            if (!bDone) {
+                addWallLine( -1, w );
+            }
+        }
+    }
+
+    // draw either the static or the dynamic walls of all sectors
+    void drawSectors( bool bDynamic ) {
+        // collect the walls first, so that they can be drawn in one batch
+        vWallLines.clear();
+        vLodPoints.clear();
+        if (bDynamic) {
+            collectDynamicWalls();
+        } else {
+            collectStaticWalls();
+        }
+        // draw the walls as lines, then draw the (highlighted) end points on top
+        drawLinesTiled( vWallLines.data(), int( vWallLines.size() ), bAntiAlias );
+        for (const LineSeg &l : vWallLines) {
+            drawLine( l.x1, l.y1, l.x1, l.y1, 255, 255, 255 );
+            drawLine( l.x2, l.y2, l.x2, l.y2, 255, 255, 255 );
+        }
+        // sectors (or groups of them) that are smaller than a pixel
+        drawLines( vLodPoints.data(), int( vLodPoints.size() ));
+    }
 
-        // draw player
+    void drawPlayer() {
         int dx = M.sin[P.a] * 12;   // for angle indicator of player
         int dy = M.cos[P.a] * 12;
-        drawPixel(  P.x       / G.scale,  P.y       / G.scale, 0, 255, 0 );   // show player as a bright green pixel
-        drawPixel( (P.x + dx) / G.scale, (P.y + dy) / G.scale, 0, 175, 0 );   // show angle indicator as less bright green
+        // show player as a bright green pixel, and the angle indicator as less bright green
+        drawLine( worldToScreenX( P.x      ), worldToScreenY( P.y      ), worldToScreenX( P.x      ), worldToScreenY( P.y      ), 0, 255, 0 );
+        drawLine( worldToScreenX( P.x + dx ), worldToScreenY( P.y + dy ), worldToScreenX( P.x + dx ), worldToScreenY( P.y + dy ), 0, 175, 0 );
+    }
 
-        // draw wall texture
-        float tx = 0, tx_stp = Textures[G.wt].w / 15.0;
-        float ty = 0, ty_stp = Textures[G.wt].h / 15.0;
+    // draw texture tex scaled to 15 x 15 pixels and shaded with pShade, with its lower left corner at (px, py)
+    template <class Sampler>
+    void drawTexturePreview( const TexureMaps &tex, int px, int py, const unsigned char *pShade ) {
+        float tx = 0, tx_stp = tex.w / 15.0;
+        float ty = 0, ty_stp = tex.h / 15.0;
         for (int y = 0; y < 15; y++) {
             tx = 0;
             for (int x = 0; x < 15; x++) {
-                int x2 = (int)tx % Textures[G.wt].w;
+                const int *pTexel = Sampler::texel( tex, (int)tx, (int)ty );
                 tx += tx_stp;
-                int y2 = (int)ty % Textures[G.wt].h;
-                int r = Textures[G.wt].name[(Textures[G.wt].h - y2 - 1) * 3 * Textures[G.wt].w + x2 * 3 + 0];
-                int g = Textures[G.wt].name[(Textures[G.wt].h - y2 - 1) * 3 * Textures[G.wt].w + x2 * 3 + 1];
-                int b = Textures[G.wt].name[(Textures[G.wt].h - y2 - 1) * 3 * Textures[G.wt].w + x2 * 3 + 2];
-                drawPixel( x + 145, y + 105 - 8, r, g, b );
+                drawPixel( x + px, y + py, pShade[pTexel[0]], pShade[pTexel[1]], pShade[pTexel[2]] );
             }
             ty += ty_stp;
         }
-        // draw surface texture
-        tx = 0, tx_stp = Textures[G.st].w / 15.0;
-        ty = 0, ty_stp = Textures[G.st].h / 15.0;
-        for(int y = 0; y < 15; y++) {
-            tx = 0;
-            for(int x = 0; x < 15; x++) {
-                int x2 = (int)tx % Textures[G.st].w;
-                tx += tx_stp;
-                int y2 = (int)ty % Textures[G.st].h;
-                int r = Textures[G.st].name[(Textures[G.st].h - y2 - 1) * 3 * Textures[G.st].w + x2 * 3 + 0];
-                int g = Textures[G.st].name[(Textures[G.st].h - y2 - 1) * 3 * Textures[G.st].w + x2 * 3 + 1];
-                int b = Textures[G.st].name[(Textures[G.st].h - y2 - 1) * 3 * Textures[G.st].w + x2 * 3 + 2];
-                drawPixel( x + 145, y + 105 - 24 - 8, r, g, b );
-            }
-            ty += ty_stp; //*G.ss;
+    }
+
+    void drawTexturePreview( int t, int px, int py, int nShade ) {
+        const unsigned char *pShade = L.shade[std::clamp( nShade, 0, SHADE_LEVELS - 1 )];
+        if (Textures[t].bPow2) { drawTexturePreview<SamplePow2>( Textures[t], px, py, pShade ); }
+        else                   { drawTexturePreview<SampleAny >( Textures[t], px, py, pShade ); }
+    }
+
+    // draw texture previews and numbers in the button column
+    void drawButtonInfo() {
+        // draw wall texture, shaded like the selected wall shows in 3D, and surface texture
+        int nWallShade = 0;
+        if (G.selS > 0 && G.selW > 0) {
+            nWallShade = W[S[G.selS - 1].ws + G.selW - 1].shade;
+        }
+        int bx = GRID_W, by = SH - BUTTONS_H;    // lower left of the button column
+        drawTexturePreview( G.wt, bx, by + 105 - 8, nWallShade );
+        drawTexturePreview( G.st, bx, by + 105 - 24 - 8, 0 );
+        //draw numbers
+        drawNumber( bx - 5, by + 90, G.wu   ); // wall u
+        drawNumber( bx + 3, by + 90, G.wv   ); // wall v
+        drawNumber( bx + 3, by + 66, G.ss   ); // surface v
+        drawNumber( bx + 3, by + 58, G.z2   ); // top height
+        drawNumber( bx + 3, by + 50, G.z1   ); // bottom height
+        drawNumber( bx + 3, by + 26, G.selS ); // sector number
+        drawNumber( bx + 3, by + 18, G.selW ); // wall number
+    }
+
+    // the static layer caches everything that only changes on edits: background, walls that are not
+    // dynamic, texture previews and numbers. It is keyed on the version counters and on what is dynamic
+    typedef struct {
+        olc::Sprite *pSprite = nullptr;
+        int nGeometry = -1, nEditor = -1, nView = -1;   // versions it was rendered at
+        int nSelS, nAddSect, nMoveA, nMoveB;  // which walls were left out (dynamic)
+        bool bAntiAlias;
+    } StaticLayer;
+    StaticLayer layerStatic;
+
+    bool staticLayerValid() {
+        return layerStatic.nGeometry  == V.nGeometry  && layerStatic.nEditor == V.nEditor &&
+               layerStatic.nView      == V.nView      &&
+               layerStatic.nSelS      == G.selS       && layerStatic.nAddSect == G.addSect &&
+               layerStatic.nMoveA     == G.move[0]    && layerStatic.nMoveB   == G.move[2] &&
+               layerStatic.bAntiAlias == bAntiAlias;
+    }
+
+    void renderStaticLayer() {
+        olc::Sprite *pPrevTarget = GetDrawTarget();
+        SetDrawTarget( layerStatic.pSprite );
+        drawBackground();
+        drawSectors( false );
+        drawButtonInfo();
+        SetDrawTarget( pPrevTarget );
+
+        layerStatic.nGeometry  = V.nGeometry;
+        layerStatic.nEditor    = V.nEditor;
+        layerStatic.nView      = V.nView;
+        layerStatic.nSelS      = G.selS;
+        layerStatic.nAddSect   = G.addSect;
+        layerStatic.nMoveA     = G.move[0];
+        layerStatic.nMoveB     = G.move[2];
+        layerStatic.bAntiAlias = bAntiAlias;
+    }
+
+    // composite the (cached) static layer with the dynamic layer
+    void draw2D() {
+        if (!staticLayerValid()) {
+            renderStaticLayer();
+        }
+        olc::Sprite *pTarget = GetDrawTarget();
+        for (int y = 0; y < SH; y++) {
+            std::copy( layerStatic.pSprite->GetData() + y * SW, layerStatic.pSprite->GetData() + (y + 1) * SW,
+                       pTarget->GetData() + y * pTarget->width );
+        }
+
+        drawSectors( true );
+        drawRegion();
+        drawPlayer();
+    }
+
+    // highlighted buttons: bit n set means Buttons[n] is darkened
+    int nDarkMask = 0;
+    int nHoverButton = BUTTON_NONE;        // button under the mouse
+    std::vector<int> vGrabbed;             // scratch for the wall end points at the grabbed position
+    int nDragSect[2] = { -1, -1 };         // sectors of the grabbed walls G.move[0] and G.move[2]
+    bool bDragged = false;                 // a grabbed point was moved, the geometry version is bumped on release
+
+    // button number per logical pixel of the button column, so that finding the button at a position is a
+    // single lookup whatever the number of buttons
+    std::vector<unsigned char> vHitMap;
+
+    void buildHitMap() {
+        vHitMap.assign( BUTTONS_W * BUTTONS_H, BUTTON_NONE );
+        for (int n = 1; n < BUTTON_COUNT; n++) {
+            const ButtonRect &r = Buttons[n].hit;
+            for (int y = r.ys; y < r.ye; y++) {
+                std::fill( vHitMap.begin() + y * BUTTONS_W + r.xs, vHitMap.begin() + y * BUTTONS_W + r.xe, (unsigned char)n );
+            }
+        }
+    }
+
+    // button at logical pixel (bx, by) relative to the upper left of the button column
+    int buttonAt( int bx, int by ) {
+        if (bx < 0 || bx >= BUTTONS_W || by < 0 || by >= BUTTONS_H) {
+            return BUTTON_NONE;
+        }
+        return vHitMap[by * BUTTONS_W + bx];
+    }
+
+    // multiply the rgb channels of all pixels in rectangle r of the draw target by nMul / 256
+    void blendRect( const ButtonRect &r, int nMul ) {
+        olc::Sprite *pTarget = GetDrawTarget();
+        int xs = std::max( r.xs, 0 ), xe = std::min( r.xe, pTarget->width  );
+        int ys = std::max( r.ys, 0 ), ye = std::min( r.ye, pTarget->height );
+        for (int y = ys; y < ye; y++) {
+            olc::Pixel *pRow = pTarget->GetData() + y * pTarget->width;
+            int x = xs;
+#ifdef GRID2D_SSE2
+            // four pixels per iteration in 16 bit lanes, alpha is multiplied by 256 / 256
+            __m128i vZero = _mm_setzero_si128();
+            __m128i vMul  = _mm_set_epi16( 256, nMul, nMul, nMul, 256, nMul, nMul, nMul );
+            for (; x + 4 <= xe; x += 4) {
+                __m128i vPix = _mm_loadu_si128( (const __m128i *)&pRow[x] );
+                __m128i vLo  = _mm_srli_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( vPix, vZero ), vMul ), 8 );
+                __m128i vHi  = _mm_srli_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( vPix, vZero ), vMul ), 8 );
+                _mm_storeu_si128( (__m128i *)&pRow[x], _mm_packus_epi16( vLo, vHi ));
+            }
+#endif
+            for (; x < xe; x++) {
+                pRow[x].r = uint8_t( (pRow[x].r * nMul) >> 8 );
+                pRow[x].g = uint8_t( (pRow[x].g * nMul) >> 8 );
+                pRow[x].b = uint8_t( (pRow[x].b * nMul) >> 8 );
+            }
+        }
+    }
+
+    // darken all highlighted buttons in one call. The original OpenGL code drew the clicked button
+    // over with black at 0.4 alpha, so darkening multiplies by 0.6. The add sector button stays dark
+    // (halved) for as long as a sector is being added. The button under the mouse is darkened slightly
+    void darken() {
+        for (int n = 1; n < BUTTON_COUNT; n++) {
+            int nMul = 256;
+            if (n == nHoverButton)                 { nMul = 218; }
+            if (nDarkMask & (1 << n))              { nMul = 154; }
+            if (n == BUTTON_ADD && G.addSect > 0)  { nMul = 128; }
+            if (nMul < 256) {
+                ButtonRect r = Buttons[n].dark;
+                r.xs += GRID_W;
+                r.xe += GRID_W;
+                blendRect( r, nMul );
+            }
+        }
+    }
+
+    // multi selection, made by dragging a box on the grid, or a lasso with CTRL held. Holding SHIFT adds to
+    // the current selection. A wall is selected when both its end points are in the region, a sector when all
+    // its walls are. While something is selected, the buttons apply to all of it (see bulkEdit())
+    std::vector<unsigned char> vWallSel, vSectSel;  // 1 if selected, per wall / sector
+    int nSelWalls = 0, nSelSects = 0;
+    bool bSelecting = false;               // a box or lasso is being dragged
+    bool bLasso = false, bSelectAdd = false;
+    std::vector<olc::vf2d> vRegion;        // world positions: the two box corners, or the lasso points
+    std::vector<int> vRegionHits;          // scratch for the wall end points in the region
+    std::vector<unsigned char> vWallHits;  // scratch: number of end points in the region, per wall
+
+    void clearSelection() {
+        std::fill( vWallSel.begin(), vWallSel.end(), 0 );
+        std::fill( vSectSel.begin(), vSectSel.end(), 0 );
+        nSelWalls = 0;
+        nSelSects = 0;
+        nSelSerial += 1;
+        V.nEditor += 1;
+    }
+
+    // make sector nSel - 1 the selected sector (none if nSel is 0), and load its settings into G
+    void selectSector( int nSel ) {
+        G.selS = nSel;
+        G.selW = 0;
+        if(G.selS == 0) {
+            initGlobals();      // defaults
+        } else {
+            int s = G.selS - 1;
+            G.z1 = S[s].z1;         // sector bottom height
+            G.z2 = S[s].z2;         // sector top    height
+            G.st = S[s].st;         // surface texture
+            G.ss = S[s].ss;         // surface scale
+            G.wt = W[S[s].ws].wt;
+            G.wu = W[S[s].ws].u;
+            G.wv = W[S[s].ws].v;
+        }
+    }
+
+    // crossing number test of (x, y) against the lasso polygon
+    bool inLasso( float x, float y ) {
+        bool bIn = false;
+        for (size_t i = 0, j = vRegion.size() - 1; i < vRegion.size(); j = i++) {
+            const olc::vf2d &a = vRegion[i], &b = vRegion[j];
+            if ((a.y > y) != (b.y > y) && x < a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y)) {
+                bIn = !bIn;
+            }
+        }
+        return bIn;
+    }
+
+    // select the walls and sectors in the dragged region. The candidate end points come from the vertex tree.
+    // A click without dragging selects the sector under the mouse instead, or adds it with SHIFT held
+    void selectRegion() {
+        if (!bSelectAdd) {
+            clearSelection();
+        }
+        float x1 = vRegion[0].x, y1 = vRegion[0].y, x2 = x1, y2 = y1;
+        for (const olc::vf2d &p : vRegion) {
+            x1 = std::min( x1, p.x ); x2 = std::max( x2, p.x );
+            y1 = std::min( y1, p.y ); y2 = std::max( y2, p.y );
+        }
+        if (x2 - x1 < VP.scale && y2 - y1 < VP.scale) {
+            int s = pickSector( int( floorf( x1 )), int( floorf( y1 )));
+            if (!bSelectAdd) {
+                selectSector( s + 1 );
+            } else if (s >= 0 && !vSectSel[s]) {
+                for (int w = S[s].ws; w < S[s].we; w++) {
+                    nSelWalls += 1 - vWallSel[w];
+                    vWallSel[w] = 1;
+                }
+                vSectSel[s] = 1;
+                nSelSects += 1;
+                G.selS = 0;
+                G.selW = 0;
+                nSelSerial += 1;
+                V.nEditor += 1;
+            }
+            return;
+        }
+        vRegionHits.clear();
+        VT.inBox( int( ceilf( x1 )), int( ceilf( y1 )), int( floorf( x2 )), int( floorf( y2 )), vRegionHits );
+        for (int id : vRegionHits) {
+            int w = id >> 1, px, py;
+            VT.point( id, px, py );
+            if (bLasso && !inLasso( float( px ), float( py ))) {
+                continue;
+            }
+            vWallHits[w] += 1;
+            if (vWallHits[w] == 2 && !vWallSel[w]) {
+                vWallSel[w] = 1;
+                nSelWalls += 1;
+            }
+        }
+        for (int id : vRegionHits) {
+            vWallHits[id >> 1] = 0;
+        }
+        for (int s = 0; s < numSect; s++) {
+            int w = S[s].ws;
+            while (w < S[s].we && vWallSel[w]) {
+                w++;
+            }
+            if (!vSectSel[s] && S[s].we > S[s].ws && w == S[s].we) {
+                vSectSel[s] = 1;
+                nSelSects += 1;
+            }
+        }
+        G.selS = 0;
+        G.selW = 0;
+        nSelSerial += 1;
+        V.nEditor += 1;
+    }
+
+    // set the fields in nFields (EDIT_ flags) of all selected walls and sectors to the editor settings in G.
+    // This is a single pass over the walls and one over the sectors, without branches on the selection
+    void bulkEdit( int nFields ) {
+        auto fieldMask = [=]( int nField ) { return (nFields & nField) ? -1 : 0; };
+#ifdef GRID2D_SSE2
+        // wt, u, v and shade of a wall are adjacent, as are z1, z2, d and st of a sector, so one 128 bit
+        // masked select updates a wall, and one plus the surface scale updates a sector
+        static_assert( offsetof( Wall, u )     == offsetof( Wall, wt ) +     sizeof( int ) &&
+                       offsetof( Wall, v )     == offsetof( Wall, wt ) + 2 * sizeof( int ) &&
+                       offsetof( Wall, shade ) == offsetof( Wall, wt ) + 3 * sizeof( int ), "bulkEdit() assumes wt, u, v, shade are adjacent" );
+        static_assert( offsetof( Sector, z2 ) == offsetof( Sector, z1 ) +     sizeof( int ) &&
+                       offsetof( Sector, d )  == offsetof( Sector, z1 ) + 2 * sizeof( int ) &&
+                       offsetof( Sector, st ) == offsetof( Sector, z1 ) + 3 * sizeof( int ), "bulkEdit() assumes z1, z2, d, st are adjacent" );
+        __m128i vWallNew  = _mm_set_epi32( 0, G.wv, G.wu, G.wt );
+        __m128i vWallMask = _mm_set_epi32( 0, fieldMask( EDIT_WV ), fieldMask( EDIT_WU ), fieldMask( EDIT_WT ));
+        for (int w = 0; w < numWall; w++) {
+            __m128i vMask = _mm_and_si128( vWallMask, _mm_set1_epi32( -int( vWallSel[w] )));
+            __m128i *p = (__m128i *)&W[w].wt;
+            _mm_storeu_si128( p, _mm_or_si128( _mm_and_si128( vMask, vWallNew ), _mm_andnot_si128( vMask, _mm_loadu_si128( p ))));
+        }
+        __m128i vSectNew  = _mm_set_epi32( G.st, 0, G.z2, G.z1 );
+        __m128i vSectMask = _mm_set_epi32( fieldMask( EDIT_ST ), 0, fieldMask( EDIT_Z ), fieldMask( EDIT_Z ));
+        int nMaskSS = fieldMask( EDIT_SS );
+        for (int s = 0; s < numSect; s++) {
+            int nSel = -int( vSectSel[s] );
+            __m128i vMask = _mm_and_si128( vSectMask, _mm_set1_epi32( nSel ));
+            __m128i *p = (__m128i *)&S[s].z1;
+            _mm_storeu_si128( p, _mm_or_si128( _mm_and_si128( vMask, vSectNew ), _mm_andnot_si128( vMask, _mm_loadu_si128( p ))));
+            S[s].ss = (G.ss & nMaskSS & nSel) | (S[s].ss & ~(nMaskSS & nSel));
+        }
+#else
+        auto pick = []( int nOld, int nNew, int nMask ) { return (nNew & nMask) | (nOld & ~nMask); };
+        int nMaskWT = fieldMask( EDIT_WT ), nMaskWU = fieldMask( EDIT_WU ), nMaskWV = fieldMask( EDIT_WV );
+        for (int w = 0; w < numWall; w++) {
+            int nSel = -int( vWallSel[w] );
+            W[w].wt = pick( W[w].wt, G.wt, nMaskWT & nSel );
+            W[w].u  = pick( W[w].u,  G.wu, nMaskWU & nSel );
+            W[w].v  = pick( W[w].v,  G.wv, nMaskWV & nSel );
+        }
+        int nMaskZ = fieldMask( EDIT_Z ), nMaskST = fieldMask( EDIT_ST ), nMaskSS = fieldMask( EDIT_SS );
+        for (int s = 0; s < numSect; s++) {
+            int nSel = -int( vSectSel[s] );
+            S[s].z1 = pick( S[s].z1, G.z1, nMaskZ  & nSel );
+            S[s].z2 = pick( S[s].z2, G.z2, nMaskZ  & nSel );
+            S[s].st = pick( S[s].st, G.st, nMaskST & nSel );
+            S[s].ss = pick( S[s].ss, G.ss, nMaskSS & nSel );
+        }
+#endif
+        V.nGeometry += 1;
+    }
+
+    // delete the selected sectors. The walls of the remaining sectors are moved together, so that W has no
+    // unused walls in between
+    void deleteSelected() {
+        // a selected sector of an instance deletes the whole instance
+        for (int s = 0; s < numSect; s++) {
+            if (vSectSel[s] && S[s].inst > 0) {
+                Instances[S[s].inst - 1].prefab = -1;
+            }
+        }
+        for (int s = 0; s < numSect; s++) {
+            if (S[s].inst > 0 && Instances[S[s].inst - 1].prefab < 0) {
+                vSectSel[s] = 1;
+            }
+        }
+        std::vector<Wall> vKeep;
+        vKeep.reserve( numWall );
+        int nKeep = 0;
+        for (int s = 0; s < numSect; s++) {
+            if (!vSectSel[s]) {
+                Sector sect = S[s];
+                sect.ws = int( vKeep.size());
+                vKeep.insert( vKeep.end(), W + S[s].ws, W + S[s].we );
+                sect.we = int( vKeep.size());
+                S[nKeep++] = sect;
+            }
+        }
+        std::copy( vKeep.begin(), vKeep.end(), W );
+        numSect = nKeep;
+        numWall = int( vKeep.size());
+        VT.build( S, numSect, W );
+        clearSelection();
+        G.selS = 0;
+        G.selW = 0;
+        V.nGeometry += 1;
+    }
+
+    // transforms of the selected sectors: move (CTRL + arrows, by a grid step), rotate (Q / E, by 15 degrees, or
+    // by 1 with SHIFT held), scale (Z / X, in quarter steps) and mirror (H left to right, J top to bottom). They
+    // add up, and are applied to a copy of the walls taken at the first transform of a selection, so that steps
+    // don't accumulate rounding errors. The result is snapped to the grid new points are put on. A step that
+    // would snap a wall to a single point, or a sector flat, is refused, and leaves the selection as it was.
+    // Instances keep their shape: while one is selected, the whole selection turns by quarter turns, and scaling
+    // is refused
+    typedef struct {
+        int nMoveX, nMoveY;        // in grid steps
+        int nAngle;                // counter clockwise, in degrees
+        int nScale;                // in quarters
+        bool bMirrorX, bMirrorY;
+        int nCenterX, nCenterY;    // the center of the rotation, scaling and mirroring
+        int nGeometry;             // geometry version after the last transform, the copy is outdated otherwise
+        int nSelection;            // selection the copy is of
+    } Transform;
+    Transform xform = { 0, 0, 0, 4, false, false, 0, 0, -1, -1 };
+    int nSelSerial = 0;                    // changes whenever the selection does
+    std::vector<Wall> vXformBase;          // the walls of the selected sectors before the transform, in order
+    std::vector<int> vXformSects;          // the selected sectors
+
+    void transformKeys() {
+        if (nSelSects == 0 || G.addSect != 0) {
+            return;
+        }
+        bool bCtrl = GetKey( olc::Key::CTRL ).bHeld, bShift = GetKey( olc::Key::SHIFT ).bHeld;
+        int nMoveX = 0, nMoveY = 0, nTurn = 0, nScale = 0;
+        bool bMirrorX = false, bMirrorY = false, bChanged = false;
+        auto pressed = [&]( olc::Key k, bool bMod ) { bool b = bMod && GetKey( k ).bPressed; bChanged |= b; return b; };
+        if (pressed( olc::Key::LEFT,  bCtrl )) { nMoveX -= 1; }
+        if (pressed( olc::Key::RIGHT, bCtrl )) { nMoveX += 1; }
+        if (pressed( olc::Key::DOWN,  bCtrl )) { nMoveY -= 1; }
+        if (pressed( olc::Key::UP,    bCtrl )) { nMoveY += 1; }
+        if (pressed( olc::Key::Q, true )) { nTurn += 1; }
+        if (pressed( olc::Key::E, true )) { nTurn -= 1; }
+        if (pressed( olc::Key::Z, true )) { nScale -= 1; }
+        if (pressed( olc::Key::X, true )) { nScale += 1; }
+        if (pressed( olc::Key::H, true )) { bMirrorX = true; }
+        if (pressed( olc::Key::J, true )) { bMirrorY = true; }
+        if (!bChanged) {
+            return;
+        }
+        // the sectors of the level itself are transformed, then the instances, whose origins move about the same
+        // center
+        bool bOwn = false, bInst = false;
+        int x1 = INT_MAX, y1 = INT_MAX, x2 = INT_MIN, y2 = INT_MIN;
+        for (int s = 0; s < numSect; s++) {
+            if (vSectSel[s]) {
+                bOwn  |= S[s].inst == 0;
+                bInst |= S[s].inst != 0;
+            }
+            for (int w = S[s].ws; w < S[s].we && vSectSel[s] && S[s].inst != 0; w++) {
+                x1 = std::min( x1, W[w].x1 ); x2 = std::max( x2, W[w].x1 );
+                y1 = std::min( y1, W[w].y1 ); y2 = std::max( y2, W[w].y1 );
+            }
+        }
+        if (bInst && nScale != 0) {
+            return;
+        }
+        int nGrid = 8 * G.scale;
+        int nCenterX = int( lrintf( (x1 / 2.0f + x2 / 2.0f) / nGrid )) * nGrid;
+        int nCenterY = int( lrintf( (y1 / 2.0f + y2 / 2.0f) / nGrid )) * nGrid;
+        if (bOwn) {
+            Transform t = xform;
+            if (t.nGeometry != V.nGeometry || t.nSelection != nSelSerial) {
+                t = { 0, 0, 0, 4, false, false, 0, 0, -1, nSelSerial };
+            }
+            int nStep = bInst ? 90 : bShift ? 1 : 15;
+            // the mirrors are about the axes of the world: a single mirror of the turned copy turns it the other way
+            if (bMirrorX != bMirrorY) {
+                t.nAngle = 360 - t.nAngle;
+            }
+            t.nMoveX  += nMoveX;
+            t.nMoveY  += nMoveY;
+            t.nAngle   = ((t.nAngle + nTurn * nStep) % 360 + 360) % 360;
+            t.nScale   = std::clamp( t.nScale + nScale, 1, 64 );
+            t.bMirrorX = t.bMirrorX != bMirrorX;
+            t.bMirrorY = t.bMirrorY != bMirrorY;
+            if (!transformSelection( t )) {
+                return;
+            }
+            // the center of this step: the center of the copy, where the moves so far took it
+            nCenterX = xform.nCenterX + (xform.nMoveX - nMoveX) * nGrid;
+            nCenterY = xform.nCenterY + (xform.nMoveY - nMoveY) * nGrid;
+        }
+        if (!bInst) {
+            return;
+        }
+        bool bValid = xform.nGeometry == V.nGeometry && xform.nSelection == nSelSerial;
+        transformInstances( nMoveX, nMoveY, nTurn, bMirrorX, bMirrorY, nCenterX, nCenterY );
+        if (bValid) {
+            xform.nGeometry = V.nGeometry;
+        }
+    }
+
+    // set the walls of the selected sectors to their copy transformed by t. Returns false, with the walls left as
+    // they were, if t collapses a wall or a sector
+    bool transformSelection( Transform t ) {
+        int nGrid = 8 * G.scale;
+        bool bNewCopy = t.nGeometry != V.nGeometry || t.nSelection != nSelSerial;
+        if (bNewCopy) {
+            // take a new copy, and put the center on the grid point nearest to the middle of the selection
+            vXformBase.clear();
+            vXformSects.clear();
+            int x1 = INT_MAX, y1 = INT_MAX, x2 = INT_MIN, y2 = INT_MIN;
+            for (int s = 0; s < numSect; s++) {
+                if (vSectSel[s] && S[s].inst == 0) {
+                    vXformSects.push_back( s );
+                    vXformBase.insert( vXformBase.end(), W + S[s].ws, W + S[s].we );
+                    for (int w = S[s].ws; w < S[s].we; w++) {
+                        x1 = std::min( x1, W[w].x1 ); x2 = std::max( x2, W[w].x1 );
+                        y1 = std::min( y1, W[w].y1 ); y2 = std::max( y2, W[w].y1 );
+                    }
+                }
+            }
+            t.nCenterX = int( lrintf( (x1 / 2.0f + x2 / 2.0f) / nGrid )) * nGrid;
+            t.nCenterY = int( lrintf( (y1 / 2.0f + y2 / 2.0f) / nGrid )) * nGrid;
+            t.nSelection = nSelSerial;
+        }
+        int nPoints = transformWalls( t, nGrid );
+        if (nPoints < 0) {
+            // put the walls back: the copy itself, or the copy under the last transform that was accepted
+            if (bNewCopy) {
+                int nBase = 0;
+                for (int s : vXformSects) {
+                    std::copy( vXformBase.begin() + nBase, vXformBase.begin() + nBase + (S[s].we - S[s].ws), W + S[s].ws );
+                    nBase += S[s].we - S[s].ws;
+                }
+            } else {
+                transformWalls( xform, nGrid );
+            }
+            return false;
+        }
+        // the vertex tree: point by point for small selections, rebuilt for large ones
+        if (nPoints < VT.size() / 4) {
+            for (int s : vXformSects) {
+                for (int w = S[s].ws; w < S[s].we; w++) {
+                    VT.setPoint( w * 2,     W[w].x1, W[w].y1 );
+                    VT.setPoint( w * 2 + 1, W[w].x2, W[w].y2 );
+                }
+            }
+        } else {
+            VT.build( S, numSect, W );
+        }
+        V.nGeometry += 1;
+        t.nGeometry = V.nGeometry;
+        xform = t;
+        return true;
+    }
+
+    // the walls of the sectors in vXformSects are set to their copy in vXformBase, transformed by t and
+    // snapped to multiples of nGrid, in one pass that also updates their shade. Returns the number of points, or
+    // -1 if a wall ends up with both ends on the same point, or a sector with an area of zero or less
+    int transformWalls( const Transform &t, int nGrid ) {
+        // (x, y) relative to the center goes to (a x + b y, c x + d y) + offset
+        float fScale = t.nScale / 4.0f;
+        float fScaleX = t.bMirrorX ? -fScale : fScale, fScaleY = t.bMirrorY ? -fScale : fScale;
+        float a = M.cos[t.nAngle] * fScaleX, b = -M.sin[t.nAngle] * fScaleY;
+        float c = M.sin[t.nAngle] * fScaleX, d =  M.cos[t.nAngle] * fScaleY;
+        float fOffX = float( t.nCenterX + t.nMoveX * nGrid ), fOffY = float( t.nCenterY + t.nMoveY * nGrid );
+        float fCenterX = float( t.nCenterX ), fCenterY = float( t.nCenterY );
+        float fGrid = float( nGrid ), fInvGrid = 1.0f / fGrid;
+        // a single mirror turns the walls clockwise. To keep them counter clockwise, the walls of each sector are
+        // put in reverse order, with their end points swapped
+        bool bReverse = t.bMirrorX != t.bMirrorY;
+#ifdef GRID2D_SSE2
+        __m128 vCenter = _mm_setr_ps( fCenterX, fCenterY, fCenterX, fCenterY );
+        __m128 vOff    = _mm_setr_ps( fOffX, fOffY, fOffX, fOffY );
+        __m128 vDiag   = _mm_setr_ps( a, d, a, d );
+        __m128 vCross  = _mm_setr_ps( b, c, b, c );
+        __m128 vGrid   = _mm_set1_ps( fGrid ), vInvGrid = _mm_set1_ps( fInvGrid );
+#endif
+        int nBase = 0, nPoints = 0;
+        bool bCollapsed = false;
+        for (int s : vXformSects) {
+            int nWalls = S[s].we - S[s].ws;
+            long long nArea = 0, nBaseArea = 0;   // twice the area, positive for counter clockwise walls
+            for (int k = 0; k < nWalls; k++) {
+                const Wall &src = vXformBase[nBase + (bReverse ? nWalls - 1 - k : k)];
+                Wall &dst = W[S[s].ws + k];
+#ifdef GRID2D_SSE2
+                // x1, y1, x2, y2 in one register
+                __m128 vP = _mm_sub_ps( _mm_cvtepi32_ps( _mm_loadu_si128( (const __m128i *)&src.x1 )), vCenter );
+                __m128 vSwap = _mm_shuffle_ps( vP, vP, _MM_SHUFFLE( 2, 3, 0, 1 ));     // y1, x1, y2, x2
+                vP = _mm_add_ps( _mm_add_ps( _mm_mul_ps( vP, vDiag ), _mm_mul_ps( vSwap, vCross )), vOff );
+                __m128i vR = _mm_cvtps_epi32( _mm_mul_ps( _mm_cvtepi32_ps( _mm_cvtps_epi32( _mm_mul_ps( vP, vInvGrid ))), vGrid ));
+                if (bReverse) {
+                    vR = _mm_shuffle_epi32( vR, _MM_SHUFFLE( 1, 0, 3, 2 ));
+                }
+                _mm_storeu_si128( (__m128i *)&dst.x1, vR );
+#else
+                float fX1 = src.x1 - fCenterX, fY1 = src.y1 - fCenterY, fX2 = src.x2 - fCenterX, fY2 = src.y2 - fCenterY;
+                auto snap = [&]( float f ) { return int( lrintf( float( int( lrintf( f * fInvGrid ))) * fGrid )); };
+                int nX1 = snap( fX1 * a + fY1 * b + fOffX ), nY1 = snap( fY1 * d + fX1 * c + fOffY );
+                int nX2 = snap( fX2 * a + fY2 * b + fOffX ), nY2 = snap( fY2 * d + fX2 * c + fOffY );
+                if (bReverse) {
+                    std::swap( nX1, nX2 );
+                    std::swap( nY1, nY2 );
+                }
+                dst.x1 = nX1; dst.y1 = nY1;
+                dst.x2 = nX2; dst.y2 = nY2;
+#endif
+                dst.wt = src.wt;
+                dst.u  = src.u;
+                dst.v  = src.v;
+                dst.shade = wallShade( dst.x2 - dst.x1, dst.y2 - dst.y1 );
+                nArea     += (long long)dst.x1 * dst.y2 - (long long)dst.x2 * dst.y1;
+                nBaseArea += (long long)src.x1 * src.y2 - (long long)src.x2 * src.y1;
+                bCollapsed |= dst.x1 == dst.x2 && dst.y1 == dst.y2;
+            }
+            // a sector that was flat or clockwise already is left to the user
+            bCollapsed |= nBaseArea > 0 && nArea <= 0;
+            nBase += nWalls;
+            nPoints += 2 * nWalls;
+        }
+        return bCollapsed ? -1 : nPoints;
+    }
+
+    // prefabs: P turns the selected sectors into a new prefab, and puts an instance of it in their place. N puts
+    // an instance of the current prefab at the mouse, SHIFT + N makes the next prefab current (shown with the
+    // info, I). Selected instances are moved, turned and mirrored with the transform keys (see transformKeys()),
+    // turning by quarter turns. Edits of the sectors of an instance are written back to its prefab, and so show
+    // in all of its instances
+    int nPrefab = 0;                       // current prefab
+    int nInstGeometry = -1;                // geometry version at the last syncInstances()
+    std::vector<int> vInstFirst;           // scratch: first sector of each instance in S, -1 if none
+    std::vector<int> vInstList;            // scratch: list of instances
+    std::vector<unsigned char> vPrefabDirty;
+
+    // place point (px, py) of a prefab as instance in
+    void instancePoint( const Instance &in, int px, int py, int &x, int &y ) {
+        if (in.bMirror) {
+            px = -px;
+        }
+        for (int q = 0; q < in.turn; q++) {
+            int t = px; px = -py; py = t;
+        }
+        x = in.x + px;
+        y = in.y + py;
+    }
+
+    // the inverse of instancePoint()
+    void prefabPoint( const Instance &in, int x, int y, int &px, int &py ) {
+        px = x - in.x;
+        py = y - in.y;
+        for (int q = 0; q < in.turn; q++) {
+            int t = px; px = py; py = -t;
+        }
+        if (in.bMirror) {
+            px = -px;
+        }
+    }
+
+    // wall k of prefab sector ps, as placed by instance in. A mirrored instance has the walls of each sector in
+    // reverse order, with their end points swapped, so that they stay counter clockwise. The shade is not set
+    Wall instanceWall( const Instance &in, const Sector &ps, int k ) {
+        const Wall &pw = Prefabs[in.prefab].vWall[in.bMirror ? ps.we - 1 - k : ps.ws + k];
+        Wall w = pw;
+        instancePoint( in, pw.x1, pw.y1, in.bMirror ? w.x2 : w.x1, in.bMirror ? w.y2 : w.y1 );
+        instancePoint( in, pw.x2, pw.y2, in.bMirror ? w.x1 : w.x2, in.bMirror ? w.y1 : w.y2 );
+        return w;
+    }
+
+    // write the sectors of instance i into S from sector s0 on, and their walls into W from wall w0 on
+    void expandInstance( int i, int s0, int w0 ) {
+        const Instance &in = Instances[i];
+        const Prefab &pf = Prefabs[in.prefab];
+        for (size_t k = 0; k < pf.vSect.size(); k++) {
+            const Sector &ps = pf.vSect[k];
+            Sector &sect = S[s0 + k];
+            sect = ps;
+            sect.ws = w0 + ps.ws;
+            sect.we = w0 + ps.we;
+            sect.z1 += in.z;
+            sect.z2 += in.z;
+            sect.d = 0;
+            sect.inst = i + 1;
+            for (int j = 0; j < ps.we - ps.ws; j++) {
+                int w = sect.ws + j;
+                W[w] = instanceWall( in, ps, j );
+                W[w].shade = wallShade( W[w].x2 - W[w].x1, W[w].y2 - W[w].y1 );
+                VT.setPoint( w * 2,     W[w].x1, W[w].y1 );
+                VT.setPoint( w * 2 + 1, W[w].x2, W[w].y2 );
+            }
+        }
+    }
+
+    // expand instance i after the last sector and wall. Returns false if S or W is full
+    bool appendInstance( int i ) {
+        const Prefab &pf = Prefabs[Instances[i].prefab];
+        if (numSect + int( pf.vSect.size()) > MAX_SECT || numWall + int( pf.vWall.size()) > MAX_WALL) {
+            std::cout << "ERROR: appendInstance() --> no room for instance " << i << std::endl;
+            return false;
+        }
+        expandInstance( i, numSect, numWall );
+        numSect += int( pf.vSect.size());
+        numWall += int( pf.vWall.size());
+        return true;
+    }
+
+    // true if the expansion of instance i, starting at sector s0, was edited
+    bool instanceEdited( int i, int s0 ) {
+        const Instance &in = Instances[i];
+        const Prefab &pf = Prefabs[in.prefab];
+        for (size_t k = 0; k < pf.vSect.size(); k++) {
+            const Sector &ps = pf.vSect[k], &sect = S[s0 + k];
+            if (sect.z1 - in.z != ps.z1 || sect.z2 - in.z != ps.z2 || sect.st != ps.st || sect.ss != ps.ss) {
+                return true;
+            }
+            for (int j = 0; j < ps.we - ps.ws; j++) {
+                Wall w = instanceWall( in, ps, j );
+                const Wall &cur = W[sect.ws + j];
+                if (w.x1 != cur.x1 || w.y1 != cur.y1 || w.x2 != cur.x2 || w.y2 != cur.y2 ||
+                    w.wt != cur.wt || w.u  != cur.u  || w.v  != cur.v) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // copy the expansion of instance i, starting at sector s0, back into its prefab
+    void writeBackInstance( int i, int s0 ) {
+        const Instance &in = Instances[i];
+        Prefab &pf = Prefabs[in.prefab];
+        for (size_t k = 0; k < pf.vSect.size(); k++) {
+            Sector &ps = pf.vSect[k];
+            const Sector &sect = S[s0 + k];
+            ps.z1 = sect.z1 - in.z;
+            ps.z2 = sect.z2 - in.z;
+            ps.st = sect.st;
+            ps.ss = sect.ss;
+            for (int j = 0; j < ps.we - ps.ws; j++) {
+                const Wall &cur = W[sect.ws + j];
+                Wall &pw = pf.vWall[in.bMirror ? ps.we - 1 - j : ps.ws + j];
+                prefabPoint( in, cur.x1, cur.y1, in.bMirror ? pw.x2 : pw.x1, in.bMirror ? pw.y2 : pw.y1 );
+                prefabPoint( in, cur.x2, cur.y2, in.bMirror ? pw.x1 : pw.x2, in.bMirror ? pw.y1 : pw.y2 );
+                pw.wt = cur.wt;
+                pw.u  = cur.u;
+                pw.v  = cur.v;
+            }
+        }
+    }
+
+    // after geometry edits: write edited instances back to their prefabs, and expand the other instances of
+    // those prefabs again, in place. Instances that were not edited are only compared, so this is a single pass
+    // over the instance walls
+    void syncInstances() {
+        if (nInstGeometry == V.nGeometry) {
+            return;
+        }
+        vInstFirst.assign( Instances.size(), -1 );
+        for (int s = numSect - 1; s >= 0; s--) {
+            if (S[s].inst > 0) {
+                vInstFirst[S[s].inst - 1] = s;
+            }
+        }
+        vInstList.clear();
+        for (int i = 0; i < int( Instances.size()); i++) {
+            if (vInstFirst[i] >= 0 && instanceEdited( i, vInstFirst[i] )) {
+                vInstList.push_back( i );
+            }
+        }
+        if (!vInstList.empty()) {
+            vPrefabDirty.assign( Prefabs.size(), 0 );
+            for (int i : vInstList) {
+                writeBackInstance( i, vInstFirst[i] );
+                vPrefabDirty[Instances[i].prefab] = 1;
+            }
+            for (int i = 0; i < int( Instances.size()); i++) {
+                if (vInstFirst[i] >= 0 && vPrefabDirty[Instances[i].prefab]) {
+                    expandInstance( i, vInstFirst[i], S[vInstFirst[i]].ws );
+                }
+            }
+            V.nGeometry += 1;
+        }
+        nInstGeometry = V.nGeometry;
+    }
+
+    // turn the selected sectors of the level itself into a new prefab, with its origin on the grid point nearest
+    // to their middle, and replace them by an instance of it
+    void makePrefab() {
+        int nGrid = 8 * G.scale;
+        int x1 = INT_MAX, y1 = INT_MAX, x2 = INT_MIN, y2 = INT_MIN;
+        for (int s = 0; s < numSect; s++) {
+            if (vSectSel[s] && S[s].inst > 0) {
+                vSectSel[s] = 0;           // no prefabs of instances
+                nSelSects -= 1;
+            } else if (vSectSel[s]) {
+                for (int w = S[s].ws; w < S[s].we; w++) {
+                    x1 = std::min( x1, W[w].x1 ); x2 = std::max( x2, W[w].x1 );
+                    y1 = std::min( y1, W[w].y1 ); y2 = std::max( y2, W[w].y1 );
+                }
+            }
+        }
+        if (nSelSects == 0) {
+            return;
+        }
+        Instance in = { int( Prefabs.size()), int( lrintf( (x1 / 2.0f + x2 / 2.0f) / nGrid )) * nGrid,
+                                              int( lrintf( (y1 / 2.0f + y2 / 2.0f) / nGrid )) * nGrid, 0, 0, false };
+        Prefab pf;
+        for (int s = 0; s < numSect; s++) {
+            if (vSectSel[s]) {
+                Sector ps = S[s];
+                ps.ws = int( pf.vWall.size());
+                for (int w = S[s].ws; w < S[s].we; w++) {
+                    Wall pw = W[w];
+                    prefabPoint( in, W[w].x1, W[w].y1, pw.x1, pw.y1 );
+                    prefabPoint( in, W[w].x2, W[w].y2, pw.x2, pw.y2 );
+                    pf.vWall.push_back( pw );
+                }
+                ps.we = int( pf.vWall.size());
+                ps.d = 0;
+                pf.vSect.push_back( ps );
+            }
+        }
+        Prefabs.push_back( pf );
+        nPrefab = in.prefab;
+        deleteSelected();
+        Instances.push_back( in );
+        appendInstance( int( Instances.size()) - 1 );
+        V.nGeometry += 1;
+    }
+
+    void prefabKeys() {
+        if (G.addSect != 0) {
+            return;
+        }
+        if (GetKey( olc::Key::P ).bPressed) {
+            makePrefab();
+        }
+        if (GetKey( olc::Key::N ).bPressed && !Prefabs.empty()) {
+            if (GetKey( olc::Key::SHIFT ).bHeld) {
+                nPrefab = (nPrefab + 1) % int( Prefabs.size());
+                V.nEditor += 1;
+            } else {
+                Instances.push_back( { nPrefab, G.mx * G.scale, G.my * G.scale, 0, 0, false } );
+                if (!appendInstance( int( Instances.size()) - 1 )) {
+                    Instances.pop_back();
+                }
+                V.nGeometry += 1;
+            }
+        }
+    }
+
+    // move (by grid steps), turn (by quarter turns) and mirror the instances that have a sector in the selection.
+    // Their origins turn and mirror about (nCenterX, nCenterY)
+    void transformInstances( int nMoveX, int nMoveY, int nTurn, bool bMirrorX, bool bMirrorY, int nCenterX, int nCenterY ) {
+        int nGrid = 8 * G.scale;
+        vInstFirst.assign( Instances.size(), -1 );
+        vInstList.clear();
+        for (int s = 0; s < numSect; s++) {
+            int i = S[s].inst - 1;
+            if (i >= 0 && vInstFirst[i] < 0) {
+                vInstFirst[i] = s;
+            }
+            if (i >= 0 && vSectSel[s] && (vInstList.empty() || vInstList.back() != i)) {
+                vInstList.push_back( i );
+            }
+        }
+        bool bChanged = false;
+        for (int i : vInstList) {
+            Instance &in = Instances[i];
+            // mirroring left to right in the world mirrors the prefab, and turns the other way. A mirror top to
+            // bottom is that and a half turn
+            int nQuarters = (nTurn + (bMirrorY ? 2 : 0) + 4) % 4;
+            int dx = in.x - nCenterX, dy = in.y - nCenterY;
+            if (bMirrorX != bMirrorY) {
+                in.bMirror = !in.bMirror;
+                in.turn = (4 - in.turn) % 4;
+                dx = -dx;
+            }
+            in.turn = (in.turn + nQuarters) % 4;
+            for (int q = 0; q < nQuarters; q++) {
+                int t = dx; dx = -dy; dy = t;
+            }
+            in.x = nCenterX + dx + nMoveX * nGrid;
+            in.y = nCenterY + dy + nMoveY * nGrid;
+            expandInstance( i, vInstFirst[i], S[vInstFirst[i]].ws );
+            bChanged = true;
+        }
+        if (bChanged) {
+            V.nGeometry += 1;
+            nInstGeometry = V.nGeometry;
+        }
+    }
+
+    // the outline of the box or lasso that is being dragged
+    void drawRegion() {
+        if (!bSelecting) {
+            return;
+        }
+        std::vector<olc::vf2d> vCorners = vRegion;
+        if (!bLasso) {
+            vCorners = { vRegion[0], { vRegion[1].x, vRegion[0].y }, vRegion[1], { vRegion[0].x, vRegion[1].y } };
+        }
+        std::vector<LineSeg> vLines;
+        for (size_t i = 0, j = vCorners.size() - 1; i < vCorners.size(); j = i++) {
+            vLines.push_back( { worldToScreenX( vCorners[j].x ), worldToScreenY( vCorners[j].y ),
+                                worldToScreenX( vCorners[i].x ), worldToScreenY( vCorners[i].y ), olc::Pixel( 208, 208, 48 ) } );
         }
-        //draw numbers
-        drawNumber( 140, 90, G.wu   ); // wall u
-        drawNumber( 148, 90, G.wv   ); // wall v
-        drawNumber( 148, 66, G.ss   ); // surface v
-        drawNumber( 148, 58, G.z2   ); // top height
-        drawNumber( 148, 50, G.z1   ); // bottom height
-        drawNumber( 148, 26, G.selS ); // sector number
-        drawNumber( 148, 18, G.selW ); // wall number
+        drawLines( vLines.data(), int( vLines.size()));
     }
 
-    // darken buttons
-    int dark = 0;
-
-    void darken() {
-        int xs, xe, ys, ye;
-        switch (dark) {
-            case  0:                                                             return;   // no buttons were clicked
-
-            case  1: xs =   0; xe =  15; ys =   0 / G.scale; ye =  32 / G.scale; break;    // save button
-            case  2: xs =   0; xe =   3; ys =  96 / G.scale; ye = 128 / G.scale; break;    // u left
-            case  3: xs =   4; xe =   8; ys =  96 / G.scale; ye = 128 / G.scale; break;    // u right
-            case  4: xs =   7; xe =  11; ys =  96 / G.scale; ye = 128 / G.scale; break;    // v left
-            case  5: xs =  11; xe =  15; ys =  96 / G.scale; ye = 128 / G.scale; break;    // u right
-            case  6: xs =   0; xe =   8; ys = 192 / G.scale; ye = 224 / G.scale; break;    // u left
-            case  7: xs =   8; xe =  15; ys = 192 / G.scale; ye = 224 / G.scale; break;    // u right
-            case  8: xs =   0; xe =   7; ys = 224 / G.scale; ye = 256 / G.scale; break;    // Top left
-            case  9: xs =   7; xe =  15; ys = 224 / G.scale; ye = 256 / G.scale; break;    // Top right
-            case 10: xs =   0; xe =   7; ys = 256 / G.scale; ye = 288 / G.scale; break;    // Bot left
-            case 11: xs =   7; xe =  15; ys = 256 / G.scale; ye = 288 / G.scale; break;    // Bot right
-            case 12: xs =   0; xe =   7; ys = 352 / G.scale; ye = 386 / G.scale; break;    // sector left
-            case 13: xs =   7; xe =  15; ys = 352 / G.scale; ye = 386 / G.scale; break;    // sector right
-            case 14: xs =   0; xe =   7; ys = 386 / G.scale; ye = 416 / G.scale; break;    // wall left
-            case 15: xs =   7; xe =  15; ys = 386 / G.scale; ye = 416 / G.scale; break;    // wall right
-            case 16: xs =   0; xe =  15; ys = 416 / G.scale; ye = 448 / G.scale; break;    // delete
-            case 17: xs =   0; xe =  15; ys = 448 / G.scale; ye = 480 / G.scale; break;    // load
-        }
-
-        for(int y = ys; y < ye; y++) {
-            for(int x = xs; x < xe; x++) {
-//                glColor4f(0, 0, 0, 0.4);
-//                glBegin(GL_POINTS);
-//                glVertex2i(x * pixelSize + 2 + 580, (SH_BASE - y)*pixelSize);
-//                glEnd();
-
-                // I think what's happening here ^^ is that the pixels in the nested for loop range
-                // are darkened by multiplying them with 0.4f. So I mimick this effect
-                int nPixX = x * pixelSize + 2 + 580;
-                int nPixY = (SH - y) * pixelSize;
-                olc::Sprite *screenPtr = GetDrawTarget();
-                olc::Pixel curPix = screenPtr->GetPixel( nPixX, nPixY );
-                curPix *= 0.4f;
-                screenPtr->SetPixel( nPixX, nPixY, curPix );
-            }
-        }
-    }
-
-    int nFysScrnW = SW * pixelSize;
-    int nFysScrnH = SH * pixelSize;
-    int nButtonLt = int( nFysScrnW * 0.900f );
-    int nButtonRt = int( nFysScrnW * 1.000f );
-    int nButton1Q = int( nFysScrnW * 0.925f );
-    int nButton2Q = int( nFysScrnW * 0.950f );
-    int nButton3Q = int( nFysScrnW * 0.975f );
-
-
     void mouse( int x, int y ) {
 
         //round mouse x,y
-        G.mx = ((     x / pixelSize + 4) >> 3) << 3;
-        G.my = ((SH - y / pixelSize + 4) >> 3) << 3;   // round to nearest 8th
+        G.mx = int( floorDiv( int( floorf( screenToWorldX(      x / pixelSize ) / G.scale )) + 4, 8 )) * 8;
+        G.my = int( floorDiv( int( floorf( screenToWorldY( SH - y / pixelSize ) / G.scale )) + 4, 8 )) * 8;   // round to nearest 8th
 
-        // ee = exclusive-exclusive, so exclusive comparison on both boundaries
-        auto in_range_ee = [=]( int a, int a_low, int a_hgh ) {
-            return (a_low < a && a < a_hgh);
-        };
+        // world position of the mouse
+        float fMouseX = screenToWorldX(      x / pixelSize );
+        float fMouseY = screenToWorldY( SH - y / pixelSize );
+
+        // mouse position in logical pixels, relative to the upper left of the button column
+        int bx = x / pixelSize - GRID_W;
+        int by = y / pixelSize;
+        nHoverButton = x < GLSW ? buttonAt( bx, by ) : BUTTON_NONE;
 
-        if (GetMouse( 0 ).bPressed) {
+        // clicks on the 3D pane are not for the editor
+        if (GetMouse( 0 ).bPressed && x < GLSW) {
+            // each action below bumps the version of what it changes: V.nEditor for the settings shown in the
+            // button column, V.nGeometry for the level. Save, load, delete and bulk edits bump their own
             // 2D view buttons only
-            if(x > 580) {
-                // 2d 3d view buttons
-                if (in_range_ee( y, 0, 32 )) {
-                    save();
-                    dark = 1;
-                }
-                //wall texture
-                if (in_range_ee( y, 32, 96 )) {
-                    if (x < 610) { G.wt -= 1; if (G.wt <       0) { G.wt = numText; } }
-                    else         { G.wt += 1; if (G.wt > numText) { G.wt =       0; } }
-                }
-                //wall uv
-                if (in_range_ee( y, 96, 128 )) {
-                    if (x < 595) { dark = 2; G.wu -= 1; if (G.wu < 1) { G.wu = 1; } } else
-                    if (x < 610) { dark = 3; G.wu += 1; if (G.wu > 9) { G.wu = 9; } } else
-                    if (x < 625) { dark = 4; G.wv -= 1; if (G.wv < 1) { G.wv = 1; } } else
-                    if (x < 640) { dark = 5; G.wv += 1; if (G.wv > 9) { G.wv = 9; } }
-                }
-                //surface texture
-                if (in_range_ee( y, 128, 192 )) {
-                    if (x < 610) { G.st -= 1; if (G.st <       0) { G.st = numText; } }
-                    else         { G.st += 1; if (G.st > numText) { G.st =       0; } }
-                }
-                //surface uv
-                if (in_range_ee( y, 192, 222 )) {
-                    if (x < 610) { dark = 6; G.ss -= 1; if (G.ss < 1) { G.ss = 1; } }
-                    else         { dark = 7; G.ss += 1; if (G.ss > 9) { G.ss = 9; } }
-                }
-                //top height
-                if (in_range_ee( y, 222, 256 )) {
-                    if (x < 610) { dark = 8; G.z2 -= 5; if (G.z2 == G.z1) { G.z1 -= 5; } }
-                    else         { dark = 9; G.z2 += 5;                                  }
-                }
-                //bot height
-                if (in_range_ee( y, 256, 288 )) {
-                    if (x < 610) { dark = 10; G.z1 -= 5;                                  }
-                    else         { dark = 11; G.z1 += 5; if (G.z1 == G.z2) { G.z2 += 5; } }
-                }
-                //add sector
-                if (in_range_ee( y, 288, 318 )) {
-                    G.addSect += 1;
-                    G.selS = 0;
-                    G.selW = 0;
-                    if(G.addSect > 1) {
-                        G.addSect = 0;
-                    }
-                }
-                //limit
-                std::clamp( G.z1, 0, 90 );
-                std::clamp( G.z2, 5, 95 );
-
-                //select sector
-                if (in_range_ee( y, 352, 386 )) {
-                    G.selW = 0;
-                    if (x < 610) { dark = 12; G.selS -= 1; if (G.selS <       0) { G.selS = numSect; } }
-                    else         { dark = 13; G.selS += 1; if (G.selS > numSect) { G.selS =       0; } }
-                    int s = G.selS - 1;
-                    G.z1 = S[s].z1;         // sector bottom height
-                    G.z2 = S[s].z2;         // sector top    height
-                    G.st = S[s].st;         // surface texture
-                    G.ss = S[s].ss;         // surface scale
-                    G.wt = W[S[s].ws].wt;
-                    G.wu = W[S[s].ws].u;
-                    G.wv = W[S[s].ws].v;
-                    if(G.selS == 0) {
-                        initGlobals();      // defaults
+            if(bx >= 0) {
+                int nButton = buttonAt( bx, by );
+                nDarkMask |= 1 << nButton;
+                switch (nButton) {
+                    case BUTTON_SAVE:     save(); break;
+                    //wall texture
+                    case BUTTON_WT_DEC:   G.wt -= 1; if (G.wt <       0) { G.wt = numText; } break;
+                    case BUTTON_WT_INC:   G.wt += 1; if (G.wt > numText) { G.wt =       0; } break;
+                    //wall uv
+                    case BUTTON_WU_DEC:   G.wu -= 1; if (G.wu < 1) { G.wu = 1; } break;
+                    case BUTTON_WU_INC:   G.wu += 1; if (G.wu > 9) { G.wu = 9; } break;
+                    case BUTTON_WV_DEC:   G.wv -= 1; if (G.wv < 1) { G.wv = 1; } break;
+                    case BUTTON_WV_INC:   G.wv += 1; if (G.wv > 9) { G.wv = 9; } break;
+                    //surface texture
+                    case BUTTON_ST_DEC:   G.st -= 1; if (G.st <       0) { G.st = numText; } break;
+                    case BUTTON_ST_INC:   G.st += 1; if (G.st > numText) { G.st =       0; } break;
+                    //surface uv
+                    case BUTTON_SS_DEC:   G.ss -= 1; if (G.ss < 1) { G.ss = 1; } break;
+                    case BUTTON_SS_INC:   G.ss += 1; if (G.ss > 9) { G.ss = 9; } break;
+                    //top height
+                    case BUTTON_Z2_DEC:   G.z2 -= 5; if (G.z2 == G.z1) { G.z1 -= 5; } break;
+                    case BUTTON_Z2_INC:   G.z2 += 5;                                  break;
+                    //bot height
+                    case BUTTON_Z1_DEC:   G.z1 -= 5;                                  break;
+                    case BUTTON_Z1_INC:   G.z1 += 5; if (G.z1 == G.z2) { G.z2 += 5; } break;
+                    //add sector
+                    case BUTTON_ADD:
+                        clearSelection();
+                        G.addSect += 1;
+                        G.selS = 0;
+                        G.selW = 0;
+                        if(G.addSect > 1) {
+                            G.addSect = 0;
+                        }
+                        V.nEditor += 1;
+                        break;
+                    //select sector
+                    case BUTTON_SECT_DEC:
+                    case BUTTON_SECT_INC:
+                        clearSelection();
+                        if (nButton == BUTTON_SECT_DEC) { selectSector( G.selS > 0       ? G.selS - 1 : numSect ); }
+                        else                            { selectSector( G.selS < numSect ? G.selS + 1 : 0       ); }
+                        V.nEditor += 1;
+                        break;
+                    // select sector's walls
+                    case BUTTON_WALL_DEC:
+                    case BUTTON_WALL_INC: {
+                        int snw = G.selS > 0 ? S[G.selS - 1].we - S[G.selS - 1].ws : 0; // sector's number of walls
+                        if (nButton == BUTTON_WALL_DEC) { G.selW -= 1; if (G.selW <   0) { G.selW = snw; } }   // select sector wall left
+                        else                            { G.selW += 1; if (G.selW > snw) { G.selW =   0; } }   // select sector wall right
+                        if(G.selW > 0) {
+                            G.wt = W[S[G.selS - 1].ws + G.selW - 1].wt;
+                            G.wu = W[S[G.selS - 1].ws + G.selW - 1].u;
+                            G.wv = W[S[G.selS - 1].ws + G.selW - 1].v;
+                        }
+                        V.nEditor += 1;
+                        break;
                     }
+                    //delete
+                    case BUTTON_DELETE:
+                        if (G.selS > 0) {
+                            vSectSel[G.selS - 1] = 1;           // delete this one
+                        }
+                        if (G.selS > 0 || nSelSects > 0) {
+                            deleteSelected();
+                        }
+                        break;
+                    //load
+                    case BUTTON_LOAD:     load(); break;
                 }
-                // select sector's walls
-                int snw = S[G.selS - 1].we - S[G.selS - 1].ws; // sector's number of walls
-
-                if (in_range_ee( y, 386, 416 )) {
-                    if (x < 610) { dark = 14; G.selW -= 1; if (G.selW <   0) { G.selW = snw; } }   // select sector wall left
-                    else         { dark = 15; G.selW += 1; if (G.selW > snw) { G.selW =   0; } }   // select sector wall right
-                    if(G.selW > 0) {
-                        G.wt = W[S[G.selS - 1].ws + G.selW - 1].wt;
-                        G.wu = W[S[G.selS - 1].ws + G.selW - 1].u;
-                        G.wv = W[S[G.selS - 1].ws + G.selW - 1].v;
-                    }
+                // a changed setting shows in the button column, and applies to everything that is selected
+                if (Buttons[nButton].edit != 0) {
+                    V.nEditor += 1;
                 }
-                //delete
-                if (in_range_ee( y, 416, 448 )) {
-                    dark = 16;
-                    if (G.selS > 0) {
-                        int d = G.selS - 1;                         // delete this one
-                        numWall -= (S[d].we - S[d].ws);             // first subtract number of walls
-                        for (x = d; x < numSect; x++) {
-                            S[x] = S[x + 1];                        // remove from array
-                        }
-                        numSect -= 1;                               // 1 less sector
-                        G.selS = 0;
-                        G.selW = 0;                                 // deselect
-                    }
+                if (Buttons[nButton].edit != 0 && nSelWalls + nSelSects > 0) {
+                    bulkEdit( Buttons[nButton].edit );
                 }
-
-                //load
-                if (in_range_ee( y, 448, 480 )) {
-                    dark = 17;
-                    load();
+                // the selected sector takes the setting when it is drawn, and an instance passes it on
+                if (Buttons[nButton].edit != 0 && G.selS > 0 && S[G.selS - 1].inst > 0) {
+                    V.nGeometry += 1;
                 }
 
             } else {
-                //clicked on grid
+                //clicked on grid, at the grid point under the mouse or at the wall end point it snaps to
+                int nPointX = G.mx * G.scale, nPointY = G.my * G.scale;
+                int nSnap = VT.nearest( fMouseX, fMouseY, SNAP_RADIUS * VP.scale );
+                if (nSnap >= 0) {
+                    VT.point( nSnap, nPointX, nPointY );
+                }
 
                 //init new sector
                 if(G.addSect == 1) {
@@ -505,39 +2917,34 @@ private:
                     S[numSect].z2 = G.z2;
                     S[numSect].st = G.st;
                     S[numSect].ss = G.ss;
-                    W[numWall].x1 = G.mx * G.scale;
-                    W[numWall].y1 = G.my * G.scale;
-                    W[numWall].x2 = G.mx * G.scale;
-                    W[numWall].y2 = G.my * G.scale;
+                    S[numSect].inst = 0;
+                    setWallPoint( numWall, 1, nPointX, nPointY );
+                    setWallPoint( numWall, 2, nPointX, nPointY );
                     W[numWall].wt = G.wt;
                     W[numWall].u  = G.wu;
                     W[numWall].v  = G.wv;
                     numWall += 1;                                    // add 1 wall
                     numSect += 1;                                    // add this sector
                     G.addSect = 3;                                   // go to point 2
+                    V.nGeometry += 1;
                 }
 
                 //add point 2
                 else if (G.addSect == 3) {
-                    if (S[numSect - 1].ws == numWall - 1 && G.mx * G.scale <= W[S[numSect - 1].ws].x1) {
+                    if (S[numSect - 1].ws == numWall - 1 && nPointX <= W[S[numSect - 1].ws].x1) {
+                        VT.removePoint( (numWall - 1) * 2     );
+                        VT.removePoint( (numWall - 1) * 2 + 1 );
                         numWall -= 1;
                         numSect -= 1;
                         G.addSect = 0;
+                        V.nGeometry += 1;
                         std::cout << "walls must be counter clockwise" << std::endl;
                         return;
                     }
 
-                    //point 2
-                    W[numWall - 1].x2 = G.mx * G.scale;
-                    W[numWall - 1].y2 = G.my * G.scale; //x2,y2
-                    //automatic shading
-                    float ang = atan2f( W[numWall - 1].y2 - W[numWall - 1].y1, W[numWall - 1].x2 - W[numWall - 1].x1 );
-                    ang = (ang * 180) / PI;      // radians to degrees
-                    if(ang < 0) { ang += 360; }  // correct negative
-                    int shade = ang;             // shading goes from 0-90-0-90-0
-                    if(shade > 180) { shade = 180 - (shade - 180); }
-                    if(shade >  90) { shade =  90 - (shade -  90); }
-                    W[numWall - 1].shade = shade;
+                    //point 2, its shade is set by updateShades()
+                    setWallPoint( numWall - 1, 2, nPointX, nPointY ); //x2,y2
+                    V.nGeometry += 1;
 
                     // check if sector is closed
                     if(W[numWall - 1].x2 == W[S[numSect - 1].ws].x1 && W[numWall - 1].y2 == W[S[numSect - 1].ws].y1) {
@@ -550,10 +2957,8 @@ private:
                     else {
                         // init next wall
                         S[numSect - 1].we += 1;                                  // add 1 to wall end
-                        W[numWall].x1 = G.mx * G.scale;
-                        W[numWall].y1 = G.my * G.scale;
-                        W[numWall].x2 = G.mx * G.scale;
-                        W[numWall].y2 = G.my * G.scale;
+                        setWallPoint( numWall, 1, nPointX, nPointY );
+                        setWallPoint( numWall, 2, nPointX, nPointY );
                         W[numWall - 1].wt = G.wt;
                         W[numWall - 1].u = G.wu;
                         W[numWall - 1].v = G.wv;
@@ -561,58 +2966,119 @@ private:
                         numWall += 1;                                            // add 1 wall
                     }
                 }
+
+                //start a box or lasso selection
+                else if (G.addSect == 0) {
+                    bSelecting = true;
+                    bLasso     = GetKey( olc::Key::CTRL  ).bHeld;
+                    bSelectAdd = GetKey( olc::Key::SHIFT ).bHeld;
+                    vRegion.assign( bLasso ? 1 : 2, { fMouseX, fMouseY } );
+                }
             }
         }
 
-        //clear variables to move point
-        for (int w = 0; w < 4; w++) {
-            G.move[w] = -1;
+        // drag the box corner or extend the lasso (by at least a pixel), and select when the button is released
+        if (bSelecting) {
+            if (GetMouse( 0 ).bHeld) {
+                olc::vf2d &pLast = vRegion.back();
+                if (!bLasso) {
+                    pLast = { fMouseX, fMouseY };
+                } else if (std::abs( fMouseX - pLast.x ) + std::abs( fMouseY - pLast.y ) >= VP.scale) {
+                    vRegion.push_back( { fMouseX, fMouseY } );
+                }
+            } else {
+                selectRegion();
+                bSelecting = false;
+            }
         }
 
-        if(G.addSect == 0 && GetMouse( 1 ).bHeld) {
-            //move point hold id
-            for(int s = 0; s < numSect; s++) {
-                for(int w = S[s].ws; w < S[s].we; w++) {
-                    int x1 = W[w].x1, y1 = W[w].y1;
-                    int x2 = W[w].x2, y2 = W[w].y2;
-                    int mx = G.mx * G.scale, my = G.my * G.scale;
-                    if (mx < x1 + 3 && mx > x1 - 3 && my < y1 + 3 && my > y1 - 3) {
-                        G.move[0] = w;
-                        G.move[1] = 1;
-                    }
-                    if (mx < x2 + 3 && mx > x2 - 3 && my < y2 + 3 && my > y2 - 3) {
-                        G.move[2] = w;
-                        G.move[3] = 2;
-                    }
+        // grab the wall end point nearest to the mouse when the right button goes down, and keep it while the
+        // button is held. A point is normally shared by the end of one wall and the start of the next, and both
+        // are moved (see mouseMoving())
+        if (G.addSect != 0 || !GetMouse( 1 ).bHeld) {
+            if (bDragged) {
+                V.nGeometry += 1;
+                bDragged = false;
+            }
+            for (int w = 0; w < 4; w++) {
+                G.move[w] = -1;
+            }
+        } else if (GetMouse( 1 ).bPressed) {
+            int nGrab = VT.nearest( fMouseX, fMouseY, SNAP_RADIUS * VP.scale );
+            if (nGrab >= 0) {
+                int px, py;
+                VT.point( nGrab, px, py );
+                vGrabbed.clear();
+                VT.within( float( px ), float( py ), 0.0f, vGrabbed );
+                // the same end points as a scan over all walls in order would pick: the last of each kind
+                std::sort( vGrabbed.begin(), vGrabbed.end() );
+                for (int id : vGrabbed) {
+                    if (id & 1) { G.move[2] = id >> 1; G.move[3] = 2; }
+                    else        { G.move[0] = id >> 1; G.move[1] = 1; }
+                }
+                nDragSect[0] = nDragSect[1] = -1;
+                for (int s = 0; s < numSect; s++) {
+                    if (G.move[0] >= S[s].ws && G.move[0] < S[s].we) { nDragSect[0] = s; }
+                    if (G.move[2] >= S[s].ws && G.move[2] < S[s].we) { nDragSect[1] = s; }
                 }
             }
         }
 
         if(GetMouse( 0 ).bReleased) {
-            dark = 0;
+            nDarkMask = 0;
         }
     }
 
     void mouseMoving( int x, int y ) {
-        if(x < 580 && G.addSect == 0 && G.move[0] > -1) {
+        // x and y are physical pixels, the grid is the first GRID_W logical pixels
+        if(x / pixelSize < GRID_W && G.addSect == 0 && (G.move[0] > -1 || G.move[2] > -1)) {
             int Aw = G.move[0], Ax = G.move[1];
             int Bw = G.move[2], Bx = G.move[3];
-            if(Ax == 1) {
-                W[Aw].x1 = ((x + 16) >> 5) << 5;
-                W[Aw].y1 = ((GLSH - y + 16) >> 5) << 5;
+            // snap the world position under the mouse to the grid
+            int wx = int( floorDiv( int( floorf( screenToWorldX(      x / pixelSize ))) + 16, 32 )) * 32;
+            int wy = int( floorDiv( int( floorf( screenToWorldY( SH - y / pixelSize ))) + 16, 32 )) * 32;
+            int px, py;
+            VT.point( Ax > 0 ? Aw * 2 : Bw * 2 + 1, px, py );
+            if (px == wx && py == wy) {
+                return;
             }
-            if(Ax == 2) {
-                W[Aw].x2 = ((x + 16) >> 5) << 5;
-                W[Aw].y2 = ((GLSH - y + 16) >> 5) << 5;
+            if(Ax > 0) {
+                setWallPoint( Aw, Ax, wx, wy );
             }
-            if(Bx == 1) {
-                W[Bw].x1 = ((x + 16) >> 5) << 5;
-                W[Bw].y1 = ((GLSH - y + 16) >> 5) << 5;
+            if(Bx > 0) {
+                setWallPoint( Bw, Bx, wx, wy );
             }
-            if(Bx == 2) {
-                W[Bw].x2 = ((x + 16) >> 5) << 5;
-                W[Bw].y2 = ((GLSH - y + 16) >> 5) << 5;
+            // only the sectors of the dragged walls are updated while dragging. They are drawn in the dynamic
+            // layer, so the static layer stays valid. The geometry version is bumped once, when the drag ends
+            sectorMoved( nDragSect[0] );
+            if (nDragSect[1] != nDragSect[0]) {
+                sectorMoved( nDragSect[1] );
             }
+            xform.nGeometry = -1;          // a transform copy of the selection is outdated
+            bDragged = true;
+        }
+    }
+
+    // zoom the 2D view with the mouse wheel (around the mouse cursor), pan it by dragging with the
+    // middle mouse button and reset it with HOME. Mouse coordinates are in logical pixels
+    void moveView( int nMouseX, int nMouseY ) {
+        float fMouseX = float( nMouseX );
+        float fMouseY = float( SH - nMouseY );
+        if (nMouseX < GRID_W && GetMouseWheel() != 0) {
+            float wx = screenToWorldX( fMouseX );
+            float wy = screenToWorldY( fMouseY );
+            VP.scale = std::clamp( GetMouseWheel() > 0 ? VP.scale / 1.25f : VP.scale * 1.25f, 0.25f, 65536.0f );
+            VP.x = wx - fMouseX * VP.scale;
+            VP.y = wy - fMouseY * VP.scale;
+            V.nView += 1;
+        }
+        if (GetMouse( 2 ).bHeld && (nMouseX != nOldMouseX || nMouseY != nOldMouseY)) {
+            VP.x -= (nMouseX - nOldMouseX) * VP.scale;
+            VP.y += (nMouseY - nOldMouseY) * VP.scale;
+            V.nView += 1;
+        }
+        if (GetKey( olc::Key::HOME ).bPressed) {
+            initView();
         }
     }
 
@@ -635,27 +3101,546 @@ private:
             if (GetKey( olc::Key::S ).bPressed) { P.x -= dx; P.y -= dy; }
         }
         // strafe left, right
-        if (GetKey( olc::Key::LEFT  ).bPressed) { P.x -= dy; P.y += dx; }
-        if (GetKey( olc::Key::RIGHT ).bPressed) { P.x += dy; P.y -= dx; }
+        // CTRL + arrows move the selection (see transformKeys())
+        if (!GetKey( olc::Key::CTRL ).bHeld) {
+            if (GetKey( olc::Key::LEFT  ).bPressed) { P.x -= dy; P.y += dx; }
+            if (GetKey( olc::Key::RIGHT ).bPressed) { P.x += dy; P.y -= dx; }
+        }
     }
 
-    // somehow the timing mechanism is hampering the rendering
-    // so i disabled the timing mech (for now)
-    void display( float fElapsedTime ) {
-//        float fDisplayThreshold = 0.01f;
-//        T.fr1 += fElapsedTime;
-//        if(T.fr1 - T.fr2 >= fDisplayThreshold) {                  //only draw frames/second according to threshold
-            draw2D();
-            darken();
+    void display() {
+        draw2D();
+        darken();
+        draw3D();
+    }
+
+    // ==============================/   3D preview   /==============================
+
+    bool b3DView = true;                   // show the 3D preview pane (toggle with V)
+    std::vector<int> vSectOrder;           // sectors in view, in drawing order (far to near)
+    std::vector<WallSpan> vWallSpans;      // all projected walls of the current frame, in drawing order
+    std::vector<long long> vViewX1, vViewY1, vViewX2, vViewY2;     // walls in view space, by wall number
+    std::vector<unsigned char> vViewNear;
+    std::vector<int> vSectRuns;            // scratch: the sectors in view in wall order
+    // wall transform kernel, picked at startup on the cpu features
+    void (*pTransformWalls)( const Wall *, int, int, int, int, int, const WallViews & ) = transformWallsScalar;
+
+    // fixed point wall pipeline. All math is on 64 bit integers, exact up to world coordinates of +/- 2^24
+    // relative to the player: products of coordinates and 16.16 values stay below 2^58
+
+    // floor( a / b ) for b > 0
+    static long long floorDiv( long long a, long long b ) {
+        long long q = a / b;
+        return (a % b != 0 && a < 0) ? q - 1 : q;
+    }
+
+    // rotate world point (x, y) relative to the player into view space, z is the height relative to the player
+    ViewPoint toView( int x, int y, int z, int nCos, int nSin ) {
+        ViewPoint v;
+        v.x = (long long)x * nCos - (long long)y * nSin;
+        v.y = (long long)y * nCos + (long long)x * nSin;
+        // looking up or down shears the height with the depth
+        v.z = z * FIX_ONE + ((P.l * v.y) >> 5);
+        return v;
+    }
+
+    // move the bottom and top point of a wall end that is behind the near plane y = 1 to where the wall
+    // crosses it. The other end must be in front of the near plane
+    void clipNear( ViewPoint &pb1, ViewPoint &pt1, const ViewPoint &pb2, const ViewPoint &pt2 ) {
+        long long t = (FIX_ONE - pb1.y) * FIX_ONE / (pb2.y - pb1.y);
+        pb1.x += ((pb2.x - pb1.x) * t) >> FIX_SHIFT;
+        pb1.z += ((pb2.z - pb1.z) * t) >> FIX_SHIFT;
+        pt1.z += ((pt2.z - pt1.z) * t) >> FIX_SHIFT;
+        pt1.x = pb1.x;
+        pb1.y = pt1.y = FIX_ONE;
+    }
+
+    // project view point v to the 3D pane, screen coordinates are rounded down
+    int screenX( const ViewPoint &v ) { return int( floorDiv( v.x * FOV, v.y )) + SW3D / 2; }
+    int screenY( const ViewPoint &v ) { return int( floorDiv( v.z * FOV, v.y )) + SH   / 2; }
+
+    // transform, clip and project a wall from (x1, y1) to (x2, y2) with bottom z1 and top z2, all relative to
+    // the player, into the screen coordinates of sp. Returns false if the wall is behind the player
+    bool projectWall( int x1, int y1, int x2, int y2, int z1, int z2, int nCos, int nSin, WallSpan &sp ) {
+        ViewPoint v1 = toView( x1, y1, 0, nCos, nSin ), v2 = toView( x2, y2, 0, nCos, nSin );
+        return projectView( v1.x, v1.y, v2.x, v2.y, z1, z2, sp );
+    }
+
+    // same, for a wall of which the end points are in view space already
+    bool projectView( long long x1, long long y1, long long x2, long long y2, int z1, int z2, WallSpan &sp ) {
+        ViewPoint pb1 = { x1, y1, z1 * FIX_ONE + ((P.l * y1) >> 5) };
+        ViewPoint pt1 = { x1, y1, z2 * FIX_ONE + ((P.l * y1) >> 5) };
+        ViewPoint pb2 = { x2, y2, z1 * FIX_ONE + ((P.l * y2) >> 5) };
+        ViewPoint pt2 = { x2, y2, z2 * FIX_ONE + ((P.l * y2) >> 5) };
+        if (pb1.y < FIX_ONE && pb2.y < FIX_ONE) {
+            return false;
+        }
+        if (pb1.y < FIX_ONE) { clipNear( pb1, pt1, pb2, pt2 ); }
+        if (pb2.y < FIX_ONE) { clipNear( pb2, pt2, pb1, pt1 ); }
+        sp.x1 = screenX( pb1 ); sp.b1 = screenY( pb1 ); sp.t1 = screenY( pt1 );
+        sp.x2 = screenX( pb2 ); sp.b2 = screenY( pb2 ); sp.t2 = screenY( pt2 );
+        return true;
+    }
+
+    int nPlayerSect = -1;                  // sector under the player (see pickSector()), or -1
+
+    // point in polygon test (crossing number) on the walls of sector s
+    bool insideSector( int s, int x, int y ) {
+        bool bInside = false;
+        for (int w = S[s].ws; w < S[s].we; w++) {
+            int x1 = W[w].x1, y1 = W[w].y1, x2 = W[w].x2, y2 = W[w].y2;
+            if ((y1 > y) != (y2 > y)) {
+                // is (x, y) left of where the wall crosses height y
+                long long lhs = (long long)( x - x1 ) * (y2 - y1);
+                long long rhs = (long long)( y - y1 ) * (x2 - x1);
+                if (y2 > y1 ? lhs < rhs : lhs > rhs) {
+                    bInside = !bInside;
+                }
+            }
+        }
+        return bInside;
+    }
+
+    // the sector to select for a click at (x, y), or -1. Of nested or overlapping sectors that contain the
+    // point, the one with the highest floor is picked, and of those the smallest (the innermost). Only the
+    // sectors listed in the LOD index cell of the point are candidates, and their bounding boxes are tested
+    // before their walls
+    int pickSector( int x, int y ) {
+        if (nLodGeometry != V.nGeometry || int( vSectBox.size()) != numSect) {
+            buildLodIndex();
+        }
+        auto it = mapLodCells.find( cellKey( x >> LOD_SHIFT, y >> LOD_SHIFT ));
+        if (it == mapLodCells.end()) {
+            return -1;
+        }
+        int nBest = -1;
+        long long nBestArea = 0;
+        for (int c : it->second) {
+            const BBox &b = vSectBox[c];
+            if (x < b.x1 || x > b.x2 || y < b.y1 || y > b.y2 || !insideSector( c, x, y )) {
+                continue;
+            }
+            long long nArea = 0;
+            for (int w = S[c].ws; w < S[c].we; w++) {
+                nArea += (long long)W[w].x1 * W[w].y2 - (long long)W[w].x2 * W[w].y1;
+            }
+            nArea = std::abs( nArea );
+            if (nBest < 0 || S[c].z1 > S[nBest].z1 || (S[c].z1 == S[nBest].z1 && nArea < nBestArea)) {
+                nBest = c;
+                nBestArea = nArea;
+            }
+        }
+        return nBest;
+    }
+
+    // is any part of the bounding box of sector s inside the horizontal view frustum. The box is culled
+    // if all its corners are behind the near plane, or all are beyond the left or the right side
+    bool sectorInView( int s, int nCos, int nSin ) {
+        const BBox &b = vSectBox[s];
+        const int vCornerX[4] = { b.x1, b.x2, b.x1, b.x2 };
+        const int vCornerY[4] = { b.y1, b.y1, b.y2, b.y2 };
+        // the near plane clips walls to depth 1, so the sides are tested from an apex a few units behind the
+        // player, and with a margin of a few pixels
+        long long nHalfW = SW3D / 2 + 2;
+        int nBehind = 0, nLeft = 0, nRight = 0;
+        for (int i = 0; i < 4; i++) {
+            ViewPoint v = toView( vCornerX[i] - P.x, vCornerY[i] - P.y, 0, nCos, nSin );
+            nBehind += v.y < 0;
+            nLeft   += -v.x * FOV > (v.y + 2 * FIX_ONE) * nHalfW;
+            nRight  +=  v.x * FOV > (v.y + 2 * FIX_ONE) * nHalfW;
+        }
+        return nBehind < 4 && nLeft < 4 && nRight < 4;
+    }
+
+    // the order of the sectors in view is kept from frame to frame. Sectors outside the view frustum are
+    // skipped on their bounding box, so a move only recomputes the distances of the sectors in view, and a turn
+    // only those of the sectors that come into view. The previous order is mostly right, so an insertion sort
+    // puts it in order in close to linear time. If that takes too many steps (after a jump, or an edit), a full
+    // sort is used instead. Ties are broken on the sector number, so the order doesn't depend on earlier frames
+    int nOrderGeometry = -1;               // V.nGeometry, P.x, P.y and P.a the order was made for
+    int nOrderX = INT_MIN, nOrderY = INT_MIN, nOrderA = -1;
+    int nOrderSerial = 0;                  // bumped when the distances go stale
+    std::vector<int> vOrderStamp;          // per sector, nOrderSerial at which its distance was computed
+    bool bOrderStale = false;              // some distances are stale while the player stood still
+    std::vector<unsigned char> vInView;    // scratch: 1 if the sector is in view, 2 once it is in the order
+
+    // order the sectors in view far to near, on the average distance of their wall mid points to the player
+    void orderSectors( int nCos, int nSin ) {
+        bool bMoved = nOrderGeometry != V.nGeometry || nOrderX != P.x || nOrderY != P.y || int( vOrderStamp.size()) != numSect;
+        if (!bMoved && nOrderA == P.a && !bOrderStale) {
+            return;
+        }
+        bOrderStale = false;
+        if (int( vOrderStamp.size()) != numSect) {
+            vOrderStamp.assign( numSect, 0 );
+            vInView.assign( numSect, 0 );
+        }
+        nOrderSerial += bMoved ? 1 : 0;
+        nOrderGeometry = V.nGeometry;
+        nOrderX = P.x;
+        nOrderY = P.y;
+        nOrderA = P.a;
+        // keep the sectors that are still in view in their order, and add the ones that came into view
+        for (int s = 0; s < numSect; s++) {
+            vInView[s] = sectorInView( s, nCos, nSin ) ? 1 : 0;
+        }
+        size_t n = 0;
+        for (int s : vSectOrder) {
+            if (s < numSect && vInView[s] == 1) {
+                vInView[s] = 2;
+                vSectOrder[n++] = s;
+            }
+        }
+        vSectOrder.resize( n );
+        for (int s = 0; s < numSect; s++) {
+            if (vInView[s] == 1) {
+                vSectOrder.push_back( s );
+            }
+        }
+        for (int s : vSectOrder) {
+            if (vOrderStamp[s] == nOrderSerial) {
+                continue;
+            }
+            vOrderStamp[s] = nOrderSerial;
+            double dSum = 0.0;
+            for (int w = S[s].ws; w < S[s].we; w++) {
+                double mx = (W[w].x1 + W[w].x2) / 2 - P.x;
+                double my = (W[w].y1 + W[w].y2) / 2 - P.y;
+                dSum += std::sqrt( mx * mx + my * my );
+            }
+            S[s].d = int( dSum / std::max( S[s].we - S[s].ws, 1 ));
+        }
+        auto farther = []( int a, int b ) { return S[a].d > S[b].d || (S[a].d == S[b].d && a < b); };
+        long long nSteps = 0, nBudget = 8 * (long long)vSectOrder.size() + 64;
+        for (size_t i = 1; i < vSectOrder.size() && nSteps <= nBudget; i++) {
+            int s = vSectOrder[i];
+            size_t j = i;
+            for (; j > 0 && nSteps <= nBudget && farther( s, vSectOrder[j - 1] ); j--, nSteps++) {
+                vSectOrder[j] = vSectOrder[j - 1];
+            }
+            vSectOrder[j] = s;
+        }
+        if (nSteps > nBudget) {
+            std::sort( vSectOrder.begin(), vSectOrder.end(), farther );
+        }
+    }
+
+    // transform, clip and project the walls of the sectors in view into vWallSpans, far to near
+    void prepare3D() {
+        int nCos = M.cosFix[P.a], nSin = M.sinFix[P.a];
+
+        if (nLodGeometry != V.nGeometry || int( vSectBox.size()) != numSect) {
+            buildLodIndex();
+        }
+        orderSectors( nCos, nSin );
+        nPlayerSect = pickSector( P.x, P.y );
+
+        // rotate the walls of the sectors in view into view space. Sectors that follow each other in the wall
+        // list make one run, so the kernel gets long batches (8 walls at a time with AVX2) instead of the few
+        // walls of one sector
+        if (int( vViewX1.size()) < numWall) {
+            for (std::vector<long long> *pView : { &vViewX1, &vViewY1, &vViewX2, &vViewY2 } ) {
+                pView->resize( numWall );
+            }
+            vViewNear.resize( numWall );
+        }
+        WallViews views = { vViewX1.data(), vViewY1.data(), vViewX2.data(), vViewY2.data(), vViewNear.data() };
+        vSectRuns = vSectOrder;
+        std::sort( vSectRuns.begin(), vSectRuns.end(), []( int a, int b ) { return S[a].ws < S[b].ws; } );
+        for (size_t i = 0; i < vSectRuns.size(); ) {
+            int ws = S[vSectRuns[i]].ws, we = S[vSectRuns[i]].we;
+            for (i++; i < vSectRuns.size() && S[vSectRuns[i]].ws == we; i++) {
+                we = std::max( we, S[vSectRuns[i]].we );
+            }
+            if (we > ws) {
+                WallViews run = { views.x1 + ws, views.y1 + ws, views.x2 + ws, views.y2 + ws, views.near + ws };
+                pTransformWalls( &W[ws], we - ws, P.x, P.y, nCos, nSin, run );
+            }
+        }
+
+        vWallSpans.clear();
+        for (int s : vSectOrder) {
+            // if the player is below or above the sector, its bottom or top surface is visible. The front
+            // walls mark the surface edge, the back walls fill the surface up to there (see render3D())
+            int nSurface = 0, nCycles = 1;
+            if (P.z < S[s].z1) { nSurface = 1; nCycles = 2; }
+            else
+            if (P.z > S[s].z2) { nSurface = 2; nCycles = 2; }
+
+            // both sides use the view space walls
+            for (int nBack = 0; nBack < nCycles; nBack++) {
+                for (int i = S[s].ws; i < S[s].we; i++) {
+                    // both ends behind the near plane
+                    if (vViewNear[i] == 3) {
+                        continue;
+                    }
+                    // swap the end points for the back side
+                    long long x1 = vViewX1[i], y1 = vViewY1[i];
+                    long long x2 = vViewX2[i], y2 = vViewY2[i];
+                    if (nBack == 1) {
+                        std::swap( x1, x2 );
+                        std::swap( y1, y2 );
+                    }
+                    WallSpan sp = { s, i, nBack, nSurface, 0, 0, 0, 0, 0, 0 };
+                    if (!projectView( x1, y1, x2, y2, S[s].z1 - P.z, S[s].z2 - P.z, sp )) {
+                        continue;
+                    }
+                    // walls facing away or outside the pane cover no columns
+                    if (sp.x1 >= sp.x2 || sp.x2 <= 0 || sp.x1 >= SW3D) {
+                        continue;
+                    }
+                    vWallSpans.push_back( sp );
+                }
+            }
+        }
+    }
+
+    // draw the textured and shaded columns [xs, xe) of a wall. Texture coordinates are computed from the
+    // column number, not accumulated, so any subset of columns can be drawn independently. Walls of a sector
+    // with a visible surface store the surface edge per column in pEdge
+    template <class Sampler>
+    void drawWallColumns( const WallSpan &sp, int xs, int xe, olc::Pixel *pPane, int nPitch, int *pEdge ) {
+        const Wall &wall = W[sp.w];
+        const TexureMaps &tex = Textures[wall.wt];
+        int dx = std::max( sp.x2 - sp.x1, 1 );
+        float fStepH = float( tex.w * wall.u ) / float( dx );
+        const unsigned char *pShade = L.shade[std::clamp( wall.shade, 0, SHADE_LEVELS - 1 )];
+        for (int x = xs; x < xe; x++) {
+            int y1 = int( (sp.b2 - sp.b1) * (x - sp.x1 + 0.5) / dx + sp.b1 );
+            int y2 = int( (sp.t2 - sp.t1) * (x - sp.x1 + 0.5) / dx + sp.t1 );
+            int ys = std::clamp( y1, 0, SH );
+            int ye = std::clamp( y2, 0, SH );
+            if (sp.surface == 1) { pEdge[x] = ys; }
+            if (sp.surface == 2) { pEdge[x] = ye; }
+            if (ys >= ye) {
+                continue;
+            }
+            float fStepV = float( tex.h * wall.v ) / float( y2 - y1 );
+            int tx = int( fStepH * (x - sp.x1) );
+            olc::Pixel *pPix = pPane + (SH - 1 - ys) * nPitch + x;
+            for (int y = ys; y < ye; y++, pPix -= nPitch) {
+                const int *pTexel = Sampler::texel( tex, tx, int( fStepV * (y - y1) ));
+                *pPix = olc::Pixel( pShade[pTexel[0]], pShade[pTexel[1]], pShade[pTexel[2]] );
+            }
+        }
+    }
+
+    // rows [y1, y2) of column x that show the surface of back side span sp: between the back wall and the
+    // surface edge in pEdge (the screen edge where the sector has no front wall)
+    void surfaceRows( const WallSpan &sp, int x, int &y1, int &y2, const int *pEdge ) {
+        int dx = std::max( sp.x2 - sp.x1, 1 );
+        y1 = std::clamp( int( (sp.b2 - sp.b1) * (x - sp.x1 + 0.5) / dx + sp.b1 ), 0, SH );
+        y2 = std::clamp( int( (sp.t2 - sp.t1) * (x - sp.x1 + 0.5) / dx + sp.t1 ), 0, SH );
+        if (sp.surface == 1) { y2 = pEdge[x]; }
+        if (sp.surface == 2) { y1 = pEdge[x]; }
+        if (y1 > y2) {
+            y1 = y2 = 0;
+        }
+    }
+
+    // draw the surface of back side span sp in columns [xs, xe). The columns are turned into horizontal spans:
+    // on a row, the distance to the surface is constant, so it takes one reciprocal per span, and the texture
+    // coordinates step linearly along it
+    template <class Sampler>
+    void drawSurfaceSpans( const WallSpan &sp, int xs, int xe, olc::Pixel *pPane, int nPitch, const int *pEdge, int *pSpanStart ) {
+        const Sector &sect = S[sp.s];
+        const TexureMaps &tex = Textures[sect.st];
+        int xo = SW3D / 2, yo = SH / 2;
+        float fTile = sect.ss * 7;
+        // the horizon moves with the look up / down like the walls do (by FOV / 32 pixels per step)
+        float fLookUpDown = std::min( -P.l * 6.2f * (FOV / 200.0f), float( SH ));
+        // a world unit is fTile / 60 texels, at any resolution
+        float fMoveUpDown = float( P.z - (sp.surface == 1 ? sect.z1 : sect.z2) ) / 60.0f;
+        if (fMoveUpDown == 0.0f) { fMoveUpDown = 0.001f; }
+        float fSin = M.sin[P.a], fCos = M.cos[P.a];
+        float fOffX = P.y / 60.0f * fTile, fOffY = P.x / 60.0f * fTile;
+
+        // draw row y from column xa up to xb
+        auto drawSpan = [&]( int y, int xa, int xb ) {
+            float z = float( y - yo ) + fLookUpDown; if (z == 0.0f) { z = 0.0001f; }
+            float k = fMoveUpDown * fTile / z;
+            // texture coordinates in 16.16 fixed point, as r0 + x * dr from the start of the row, so that a row
+            // gives the same texels no matter how it is split into spans. Values near the horizon are clamped,
+            // so that whole texels fit in an int
+            auto toFix = []( float f ) { return (long long)( std::clamp( f, -1.0e7f, 1.0e7f ) * FIX_ONE ); };
+            long long drx = toFix( k * fSin ), r0x = toFix( -xo * k * fSin - FOV * k * fCos + fOffX );
+            long long dry = toFix( k * fCos ), r0y = toFix( -xo * k * fCos + FOV * k * fSin - fOffY );
+            long long rx = r0x + xa * drx, ry = r0y + xa * dry;
+            olc::Pixel *pPix = pPane + (SH - 1 - y) * nPitch;
+            for (int x = xa; x < xb; x++, rx += drx, ry += dry) {
+                // mirror negative coordinates
+                long long ux = rx < 0 ? -rx + FIX_ONE : rx;
+                long long uy = ry < 0 ? -ry + FIX_ONE : ry;
+                const int *pTexel = Sampler::texel( tex, int( ux >> FIX_SHIFT ), int( uy >> FIX_SHIFT ));
+                pPix[x] = olc::Pixel( pTexel[0], pTexel[1], pTexel[2] );
+            }
+        };
 
-//            T.fr2 -= fDisplayThreshold;
-//        }
+        // walk the columns, and keep per row the column where its open span started. Rows that are left
+        // close their span, rows that are entered open one
+        int y1Open = 0, y2Open = 0;
+        for (int x = xs; x <= xe; x++) {
+            int y1 = 0, y2 = 0;
+            if (x < xe) {
+                surfaceRows( sp, x, y1, y2, pEdge );
+            }
+            for (int y = y1Open;              y < std::min( y2Open, y1 ); y++) { drawSpan( y, pSpanStart[y], x ); }
+            for (int y = std::max( y1Open, y2 ); y < y2Open;              y++) { drawSpan( y, pSpanStart[y], x ); }
+            for (int y = y1;                  y < std::min( y2, y1Open ); y++) { pSpanStart[y] = x; }
+            for (int y = std::max( y1, y2Open ); y < y2;                  y++) { pSpanStart[y] = x; }
+            y1Open = y1;
+            y2Open = y2;
+        }
+    }
+
+    // per thread scratch of the 3D renderer
+    typedef struct {
+        std::vector<int> vEdge;            // surface edge per column, of the sector being drawn
+        std::vector<int> vSpanStart;       // per row, the column where the open surface span started
+    } Scratch3D;
+    std::vector<Scratch3D> vScratch3D;
+
+    // render columns [xs, xe) of the 3D pane from the spans that prepare3D() made. Only the pixels of these
+    // columns and the scratch of thread nThread are written
+    void render3D( int xs, int xe, int nThread ) {
+        olc::Sprite *pTarget = GetDrawTarget();
+        int nPitch = pTarget->width;
+        olc::Pixel *pPane = pTarget->GetData() + SW;
+        int *pEdge = vScratch3D[nThread].vEdge.data();
+        int *pSpanStart = vScratch3D[nThread].vSpanStart.data();
+        for (int y = 0; y < SH; y++) {
+            std::fill( pPane + y * nPitch + xs, pPane + y * nPitch + xe, olc::Pixel( 0, 60, 130 ));
+        }
+        int nSect = -1;
+        for (const WallSpan &sp : vWallSpans) {
+            int x1 = std::max( sp.x1, xs );
+            int x2 = std::min( sp.x2, xe );
+            if (x1 >= x2) {
+                continue;
+            }
+            // the spans of a sector are consecutive, front sides first. Columns without a front wall keep the
+            // screen edge as surface edge
+            if (sp.s != nSect && sp.surface != 0) {
+                std::fill( pEdge + xs, pEdge + xe, sp.surface == 1 ? SH : 0 );
+            }
+            nSect = sp.s;
+            if (sp.back == 0) {
+                if (Textures[W[sp.w].wt].bPow2) { drawWallColumns<SamplePow2>( sp, x1, x2, pPane, nPitch, pEdge ); }
+                else                            { drawWallColumns<SampleAny >( sp, x1, x2, pPane, nPitch, pEdge ); }
+            } else {
+                if (Textures[S[sp.s].st].bPow2) { drawSurfaceSpans<SamplePow2>( sp, x1, x2, pPane, nPitch, pEdge, pSpanStart ); }
+                else                            { drawSurfaceSpans<SampleAny >( sp, x1, x2, pPane, nPitch, pEdge, pSpanStart ); }
+            }
+        }
+    }
+
+    // draw the 3D preview pane. Column strips don't share pixels or scratch, so they are rendered on the
+    // worker pool. The strips are narrow, so that work stealing can even out strips with many walls
+    #define STRIP_W 8
+    void draw3D() {
+        if (!b3DView) {
+            FillRect( SW, 0, SW3D, SH, olc::Pixel( 0, 30, 65 ));
+            DrawString( SW + 8, SH / 2 - 4, "V: 3D view" );
+            return;
+        }
+        prepare3D();
+        vScratch3D.resize( pPool->threads(), { std::vector<int>( SW3D ), std::vector<int>( SH ) } );
+        if (bThreaded && pPool->threads() > 1) {
+            pPool->run( (SW3D + STRIP_W - 1) / STRIP_W, [&]( int nStrip, int nThread ) {
+                render3D( nStrip * STRIP_W, std::min( (nStrip + 1) * STRIP_W, SW3D ), nThread );
+            } );
+        } else {
+            render3D( 0, SW3D, 0 );
+        }
+    }
+
+    // frame pacing: snapshot of all state that shows on screen, compared frame to frame in event driven mode
+    #define FRAME_STATE_SIZE 24
+    typedef std::array<int, FRAME_STATE_SIZE> FrameState;
+    FrameState frameLast = {};
+    bool bForceFrame = true;           // render the next frame, even if nothing changed
+
+    FrameState frameState( int nMouseX, int nMouseY ) {
+        int nButtons = (GetMouse( 0 ).bHeld ? 1 : 0) | (GetMouse( 1 ).bHeld ? 2 : 0) | (GetMouse( 2 ).bHeld ? 4 : 0);
+        return {
+            V.nGeometry, V.nEditor, V.nView,
+            P.x, P.y, P.z, P.a, P.l,
+            G.addSect, G.selS, G.selW, G.move[0], G.move[1], G.move[2], G.move[3],
+            nMouseX, nMouseY, nButtons, int( nDarkMask ),
+            bInfoFlag, bAntiAlias, T.bEventDriven, T.nFpsCap, b3DView
+        };
+    }
+
+    // cycle the frame rate cap through a list of common values (F1 down, F2 up)
+    void adjustFpsCap( int nDir ) {
+        const int vCaps[] = { 15, 30, 60, 120, 144, 240, 0 };
+        const int nCaps = sizeof( vCaps ) / sizeof( vCaps[0] );
+        int i = 0;
+        while (i < nCaps - 1 && vCaps[i] != T.nFpsCap) {
+            i += 1;
+        }
+        T.nFpsCap = vCaps[std::clamp( i + nDir, 0, nCaps - 1 )];
+        T.tNext = std::chrono::steady_clock::now();
+    }
+
+    // wait until the start of the next frame, so that at most T.nFpsCap frames are processed per second. An
+    // idle editor in event driven mode polls for input at the capped rate, or at 60 fps when uncapped
+    void paceFrame( bool bDrawn ) {
+        int nFps = T.nFpsCap;
+        if (nFps == 0 && T.bEventDriven && !bDrawn) {
+            nFps = 60;
+        }
+        if (nFps == 0) {
+            return;
+        }
+        auto tNow = std::chrono::steady_clock::now();
+        auto tPeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>( std::chrono::duration<double>( 1.0 / nFps ));
+        T.tNext += tPeriod;
+        // don't try to catch up after a long frame, start pacing again from now
+        if (T.tNext < tNow - tPeriod) {
+            T.tNext = tNow;
+        }
+        std::this_thread::sleep_until( T.tNext );
+    }
+
+    // count frames, and update the frame stats once per second
+    void frameStats( float fElapsedTime, bool bDrawn ) {
+        T.nFrames += 1;
+        T.nDrawn  += bDrawn ? 1 : 0;
+        T.fSecond += fElapsedTime;
+        if (T.fSecond >= 1.0f) {
+            T.fFps     = T.nFrames / T.fSecond;
+            T.fDrawFps = T.nDrawn  / T.fSecond;
+            T.nFrames = T.nDrawn = 0;
+            T.fSecond = 0.0f;
+            // the overlay shows the new figures
+            bForceFrame = true;
+        }
     }
 
     void init() {
         initGlobals();
+        initView();
+        for (int w = 0; w < 4; w++) {
+            G.move[w] = -1;
+        }
+        layerStatic.pSprite = new olc::Sprite( SW, SH );
+        buildHitMap();
+        vWallSel.assign(  MAX_WALL, 0 );
+        vSectSel.assign(  MAX_SECT, 0 );
+        vWallHits.assign( MAX_WALL, 0 );
+        pPool = new WorkerPool( std::max( 0, int( std::thread::hardware_concurrency()) - 1 ));
+#ifdef GRID2D_AVX2
+        if (cpuHasAVX2()) {
+            pTransformWalls = transformWallsAVX2;
+        }
+#endif
 
-        T.fr1 = T.fr2 = 0.0f;
+        T.nFpsCap = 60;
+        T.bEventDriven = true;
+        T.tNext = std::chrono::steady_clock::now();
+        T.fWork = T.fSecond = T.fFps = T.fDrawFps = 0.0f;
+        T.nFrames = T.nDrawn = 0;
 
         //init player
         P.x = 32 * 9;
@@ -668,31 +3653,426 @@ private:
         for(int x = 0; x < 360; x++) {                 //precalulate sin cos in degrees
             M.cos[x] = cos( x / 180.0 * PI );
             M.sin[x] = sin( x / 180.0 * PI );
+            M.cosFix[x] = int( lround( cos( x / 180.0 * PI ) * FIX_ONE ));
+            M.sinFix[x] = int( lround( sin( x / 180.0 * PI ) * FIX_ONE ));
+        }
+        //store shaded color values
+        for (int s = 0; s < SHADE_LEVELS; s++) {
+            for (int c = 0; c < 256; c++) {
+                L.shade[s][c] = (unsigned char)std::max( c - s / 2, 0 );
+            }
         }
 
         //define textures
-        Textures[ 0].name = T_00; Textures[ 0].h = T_00_HEIGHT; Textures[ 0].w = T_00_WIDTH;
-        Textures[ 1].name = T_01; Textures[ 1].h = T_01_HEIGHT; Textures[ 1].w = T_01_WIDTH;
-        Textures[ 2].name = T_02; Textures[ 2].h = T_02_HEIGHT; Textures[ 2].w = T_02_WIDTH;
-        Textures[ 3].name = T_03; Textures[ 3].h = T_03_HEIGHT; Textures[ 3].w = T_03_WIDTH;
-        Textures[ 4].name = T_04; Textures[ 4].h = T_04_HEIGHT; Textures[ 4].w = T_04_WIDTH;
-        Textures[ 5].name = T_05; Textures[ 5].h = T_05_HEIGHT; Textures[ 5].w = T_05_WIDTH;
-        Textures[ 6].name = T_06; Textures[ 6].h = T_06_HEIGHT; Textures[ 6].w = T_06_WIDTH;
-        Textures[ 7].name = T_07; Textures[ 7].h = T_07_HEIGHT; Textures[ 7].w = T_07_WIDTH;
-        Textures[ 8].name = T_08; Textures[ 8].h = T_08_HEIGHT; Textures[ 8].w = T_08_WIDTH;
-        Textures[ 9].name = T_09; Textures[ 9].h = T_09_HEIGHT; Textures[ 9].w = T_09_WIDTH;
-        Textures[10].name = T_10; Textures[10].h = T_10_HEIGHT; Textures[10].w = T_10_WIDTH;
-        Textures[11].name = T_11; Textures[11].h = T_11_HEIGHT; Textures[11].w = T_11_WIDTH;
-        Textures[12].name = T_12; Textures[12].h = T_12_HEIGHT; Textures[12].w = T_12_WIDTH;
-        Textures[13].name = T_13; Textures[13].h = T_13_HEIGHT; Textures[13].w = T_13_WIDTH;
-        Textures[14].name = T_14; Textures[14].h = T_14_HEIGHT; Textures[14].w = T_14_WIDTH;
-        Textures[15].name = T_15; Textures[15].h = T_15_HEIGHT; Textures[15].w = T_15_WIDTH;
-        Textures[16].name = T_16; Textures[16].h = T_16_HEIGHT; Textures[16].w = T_16_WIDTH;
-        Textures[17].name = T_17; Textures[17].h = T_17_HEIGHT; Textures[17].w = T_17_WIDTH;
-        Textures[18].name = T_18; Textures[18].h = T_18_HEIGHT; Textures[18].w = T_18_WIDTH;
-        Textures[19].name = T_19; Textures[19].h = T_19_HEIGHT; Textures[19].w = T_19_WIDTH;
-        Textures[20].name = T_20; Textures[20].h = T_20_HEIGHT; Textures[20].w = T_20_WIDTH;
-        Textures[21].name = T_21; Textures[21].h = T_21_HEIGHT; Textures[21].w = T_21_WIDTH;
+        registerTexture(  0, T_00, T_00_WIDTH, T_00_HEIGHT );
+        registerTexture(  1, T_01, T_01_WIDTH, T_01_HEIGHT );
+        registerTexture(  2, T_02, T_02_WIDTH, T_02_HEIGHT );
+        registerTexture(  3, T_03, T_03_WIDTH, T_03_HEIGHT );
+        registerTexture(  4, T_04, T_04_WIDTH, T_04_HEIGHT );
+        registerTexture(  5, T_05, T_05_WIDTH, T_05_HEIGHT );
+        registerTexture(  6, T_06, T_06_WIDTH, T_06_HEIGHT );
+        registerTexture(  7, T_07, T_07_WIDTH, T_07_HEIGHT );
+        registerTexture(  8, T_08, T_08_WIDTH, T_08_HEIGHT );
+        registerTexture(  9, T_09, T_09_WIDTH, T_09_HEIGHT );
+        registerTexture( 10, T_10, T_10_WIDTH, T_10_HEIGHT );
+        registerTexture( 11, T_11, T_11_WIDTH, T_11_HEIGHT );
+        registerTexture( 12, T_12, T_12_WIDTH, T_12_HEIGHT );
+        registerTexture( 13, T_13, T_13_WIDTH, T_13_HEIGHT );
+        registerTexture( 14, T_14, T_14_WIDTH, T_14_HEIGHT );
+        registerTexture( 15, T_15, T_15_WIDTH, T_15_HEIGHT );
+        registerTexture( 16, T_16, T_16_WIDTH, T_16_HEIGHT );
+        registerTexture( 17, T_17, T_17_WIDTH, T_17_HEIGHT );
+        registerTexture( 18, T_18, T_18_WIDTH, T_18_HEIGHT );
+        registerTexture( 19, T_19, T_19_WIDTH, T_19_HEIGHT );
+        registerTexture( 20, T_20, T_20_WIDTH, T_20_HEIGHT );
+        registerTexture( 21, T_21, T_21_WIDTH, T_21_HEIGHT );
+    }
+
+    // 3D test walls, relative to the player: a is the view angle and l the look up or down
+    typedef struct { int x1, y1, x2, y2, z1, z2, a, l; } TestWall;
+
+    // nWalls random test walls within 4096 units of the player
+    std::vector<TestWall> testWalls( int nWalls, std::mt19937 &rng ) {
+        std::vector<TestWall> vWalls( nWalls );
+        std::uniform_int_distribution<int> distPos( -4096, 4096 ), distZ( -256, 256 ), distA( 0, 359 ), distL( -10, 10 );
+        for (TestWall &t : vWalls) {
+            t = { distPos( rng ), distPos( rng ), distPos( rng ), distPos( rng ), distZ( rng ), 0, distA( rng ), distL( rng ) };
+            t.z2 = t.z1 + std::abs( distZ( rng ));
+        }
+        return vWalls;
+    }
+
+    // the original 3D wall projection, a mix of float and int math, kept as the reference for the fixed point path
+    bool projectFloat( const TestWall &t, WallSpan &sp ) {
+        float CS = M.cos[t.a], SN = M.sin[t.a];
+        int wx[4], wy[4], wz[4];
+        wx[0] = wx[2] = t.x1 * CS - t.y1 * SN;
+        wx[1] = wx[3] = t.x2 * CS - t.y2 * SN;
+        wy[0] = wy[2] = t.y1 * CS + t.x1 * SN;
+        wy[1] = wy[3] = t.y2 * CS + t.x2 * SN;
+        wz[0] = t.z1 + ((t.l * wy[0]) / 32.0);
+        wz[1] = t.z1 + ((t.l * wy[1]) / 32.0);
+        wz[2] = t.z2 + ((t.l * wy[0]) / 32.0);
+        wz[3] = t.z2 + ((t.l * wy[1]) / 32.0);
+        if (wy[0] < 1 && wy[1] < 1) {
+            return false;
+        }
+        auto clip = [&]( int i, int j ) {
+            float s = float( wy[i] ) / std::max( float( wy[i] - wy[j] ), 1.0f );
+            wx[i] = wx[i] + s * (wx[j] - wx[i]);
+            wz[i] = wz[i] + s * (wz[j] - wz[i]);
+            wy[i] = std::max( int( wy[i] + s * (wy[j] - wy[i]) ), 1 );
+        };
+        if (wy[0] < 1) { clip( 0, 1 ); clip( 2, 3 ); }
+        if (wy[1] < 1) { clip( 1, 0 ); clip( 3, 2 ); }
+        sp.x1 = wx[0] * FOV / wy[0] + SW3D / 2; sp.b1 = wz[0] * FOV / wy[0] + SH / 2; sp.t1 = wz[2] * FOV / wy[2] + SH / 2;
+        sp.x2 = wx[1] * FOV / wy[1] + SW3D / 2; sp.b2 = wz[1] * FOV / wy[1] + SH / 2; sp.t2 = wz[3] * FOV / wy[3] + SH / 2;
+        return true;
+    }
+
+    // the fixed point path on a test wall. Sets the look up or down of the player
+    bool projectFixed( const TestWall &t, WallSpan &sp ) {
+        P.l = t.l;
+        return projectWall( t.x1, t.y1, t.x2, t.y2, t.z1, t.z2, M.cosFix[t.a], M.sinFix[t.a], sp );
+    }
+
+    // check the fixed point path against the float path on vWalls, and report to console. Returns true if no wall
+    // at least 2 * FOV deep that both paths put on screen is off by more than 2 pixels
+    bool checkProjection( const std::vector<TestWall> &vWalls ) {
+        // the float path truncates view coordinates to whole units before it divides, which moves a point on
+        // screen by up to about 2 * FOV / depth pixels, plus a pixel as it rounds towards zero. Walls that are
+        // at least 2 * FOV deep must match to 2 pixels then. Near the player the float path also overflows,
+        // so screen coordinates are compared on walls that both paths put on screen only
+        int nKeepL = P.l;
+        int nCulled = 0, nCompared = 0, nFar = 0, nFarOff = 0, nDeviation = 0;
+        for (const TestWall &t : vWalls) {
+            WallSpan a = {}, c = {};
+            bool bA = projectFixed( t, a ), bC = projectFloat( t, c );
+            nCulled += bA != bC;
+            auto onScreen = []( const WallSpan &sp ) { return 0 <= sp.x1 && sp.x1 < sp.x2 && sp.x2 <= SW3D; };
+            if (bA && bC && onScreen( a ) && onScreen( c )) {
+                int nDev = std::max( { std::abs( a.x1 - c.x1 ), std::abs( a.x2 - c.x2 ), std::abs( a.b1 - c.b1 ),
+                                       std::abs( a.b2 - c.b2 ), std::abs( a.t1 - c.t1 ), std::abs( a.t2 - c.t2 ) } );
+                float y1 = t.y1 * M.cos[t.a] + t.x1 * M.sin[t.a], y2 = t.y2 * M.cos[t.a] + t.x2 * M.sin[t.a];
+                bool bFar = std::min( y1, y2 ) >= 2 * FOV;
+                nCompared += 1;
+                nFar      += bFar;
+                nFarOff   += bFar && nDev > 2;
+                nDeviation = std::max( nDeviation, nDev );
+            }
+        }
+        P.l = nKeepL;
+        std::cout << "    fixed point vs float path: " << nCulled << " walls culled by one path only, " << nFarOff
+                  << " of " << nFar << " walls at least " << 2 * FOV << " deep off by more than 2 pixels" << std::endl;
+        std::cout << "    max deviation from float path on " << nCompared << " walls on screen: " << nDeviation
+                  << " pixels" << std::endl;
+        return nFarOff == 0;
+    }
+
+    // time the renderers on synthetic data, and report to console
+    void runBenchmarks() {
+        auto timeIt = [=]( const std::string &sName, int nReps, int nItems, const std::string &sUnit, std::function<void()> func ) {
+            auto tStart = std::chrono::steady_clock::now();
+            for (int i = 0; i < nReps; i++) {
+                func();
+            }
+            std::chrono::duration<double> tElapsed = std::chrono::steady_clock::now() - tStart;
+            double dPerRep = tElapsed.count() / nReps;
+            std::cout << "  " << sName << ": " << dPerRep * 1000.0 << " ms, "
+                      << nItems / dPerRep / 1.0e6 << " M" << sUnit << "/s" << std::endl;
+        };
+        // render into an offscreen sprite, so that the screen is left alone
+        olc::Sprite sprBench( SW, SH );
+        SetDrawTarget( &sprBench );
+        std::mt19937 rng( 2024 );
+
+        std::cout << "Benchmarks:" << std::endl;
+        // dense line sets: short lines inside the view, and long lines that mostly need clipping
+        const int nLines = 100000;
+        std::vector<LineSeg> vInside( nLines ), vClipped( nLines ), vShort( nLines );
+        std::uniform_int_distribution<int> distX( 0, GRID_W - 1 ), distY( 0, SH - 1 );
+        std::uniform_int_distribution<int> distFar( -4 * SW, 4 * SW );
+        for (int i = 0; i < nLines; i++) {
+            vInside[i]  = { distX( rng ), distY( rng ), distX( rng ), distY( rng ), olc::Pixel( 128, 128, 128 ) };
+            vClipped[i] = { distFar( rng ), distFar( rng ), distFar( rng ), distFar( rng ), olc::Pixel( 128, 128, 128 ) };
+            // walls of a large map seen zoomed out are only a few pixels long
+            int x = distX( rng ), y = distY( rng );
+            vShort[i]   = { x, y, x + distX( rng ) % 7 - 3, y + distY( rng ) % 7 - 3, olc::Pixel( 128, 128, 128 ) };
+        }
+        // reference: the original float DDA line stepping through bounds checked Draw() calls
+        auto drawLineDDA = [&]( const LineSeg &l ) {
+            float x = float( l.x1 ), dx = float( l.x2 - l.x1 );
+            float y = float( l.y1 ), dy = float( l.y2 - l.y1 );
+            float fLarge = std::max( { std::abs( dx ), std::abs( dy ), 1.0f } );
+            dx /= fLarge;
+            dy /= fLarge;
+            for (int n = 0; n < fLarge; n++) {
+                Draw( int( x ), SH - 1 - int( y ), l.col );
+                x += dx;
+                y += dy;
+            }
+        };
+        timeIt( "lines, inside, DDA      ", 5, nLines, "lines", [&]() { for (const LineSeg &l : vInside)  { drawLineDDA( l ); } } );
+        timeIt( "lines, inside, Bresenham", 5, nLines, "lines", [&]() { drawLines( vInside.data(),  nLines ); } );
+        timeIt( "lines, clipped, DDA      ", 5, nLines, "lines", [&]() { for (const LineSeg &l : vClipped) { drawLineDDA( l ); } } );
+        timeIt( "lines, clipped, Bresenham", 5, nLines, "lines", [&]() { drawLines( vClipped.data(), nLines ); } );
+        timeIt( "lines, inside, Wu AA     ", 5, nLines, "lines", [&]() { drawLinesAA( vInside.data(),  nLines ); } );
+        timeIt( "lines, clipped, Wu AA     ", 5, nLines, "lines", [&]() { drawLinesAA( vClipped.data(), nLines ); } );
+        timeIt( "lines, short, Bresenham", 5, nLines, "lines", [&]() { drawLines(   vShort.data(), nLines ); } );
+        timeIt( "lines, short, Wu AA     ", 5, nLines, "lines", [&]() { drawLinesAA( vShort.data(), nLines ); } );
+
+        // tiled rasterization on the worker pool, which must give the same pixels as the single threaded path
+        olc::Sprite sprSingle( SW, SH );
+        for (bool bAA : { false, true } ) {
+            std::string sName = bAA ? "Wu AA" : "Bresenham";
+            bool bKeep = bThreaded;
+            for (const std::vector<LineSeg> *pSet : { &vInside, &vShort } ) {
+                std::fill( sprSingle.GetData(), sprSingle.GetData() + SW * SH, olc::BLACK );
+                std::fill( sprBench.GetData(),  sprBench.GetData()  + SW * SH, olc::BLACK );
+                bThreaded = false;
+                SetDrawTarget( &sprSingle );
+                drawLinesTiled( pSet->data(), nLines, bAA );
+                bThreaded = true;
+                SetDrawTarget( &sprBench );
+                drawLinesTiled( pSet->data(), nLines, bAA );
+                bool bSame = std::equal( sprSingle.GetData(), sprSingle.GetData() + SW * SH, sprBench.GetData(),
+                                         []( const olc::Pixel &a, const olc::Pixel &b ) { return a.n == b.n; } );
+                std::string sSet = pSet == &vInside ? "inside" : "short";
+                timeIt( "lines, " + sSet + ", " + sName + ", " + std::to_string( pPool->threads()) + " threads", 5, nLines, "lines",
+                        [&]() { drawLinesTiled( pSet->data(), nLines, bAA ); } );
+                std::cout << "    identical to single threaded: " << (bSame ? "yes" : "NO") << std::endl;
+            }
+            bThreaded = bKeep;
+        }
+
+        // 3D wall pipeline on walls within 4096 units of the player: the original mix of float and int math, the
+        // 16.16 fixed point path that replaced it, and the check of the fixed point path against the float path
+        const int nWalls = 100000;
+        std::vector<TestWall> vWalls = testWalls( nWalls, rng );
+        std::vector<WallSpan> vSpans( nWalls );
+        int nKeepL = P.l;
+        int nVisible = 0;
+        timeIt( "3D walls, float         ", 10, nWalls, "walls", [&]() {
+            for (int i = 0; i < nWalls; i++) { nVisible += projectFloat( vWalls[i], vSpans[i] ); } } );
+        timeIt( "3D walls, 16.16 fixed   ", 10, nWalls, "walls", [&]() {
+            for (int i = 0; i < nWalls; i++) { nVisible += projectFixed( vWalls[i], vSpans[i] ); } } );
+        P.l = nKeepL;
+        checkProjection( vWalls );
+        std::uniform_int_distribution<int> distPos( -4096, 4096 );
+
+        // batched wall transform on a 100k wall map: scalar against AVX2, which must give identical results
+        std::vector<Wall> vMap( nWalls );
+        for (int i = 0; i < nWalls; i++) {
+            vMap[i] = { distPos( rng ), distPos( rng ), distPos( rng ), distPos( rng ), 0, 1, 1, 0 };
+        }
+        std::vector<long long> vOutA( 4 * nWalls ), vOutB( 4 * nWalls );
+        std::vector<unsigned char> vNearA( nWalls ), vNearB( nWalls );
+        WallViews viewsA = { &vOutA[0], &vOutA[nWalls], &vOutA[2 * nWalls], &vOutA[3 * nWalls], vNearA.data() };
+        WallViews viewsB = { &vOutB[0], &vOutB[nWalls], &vOutB[2 * nWalls], &vOutB[3 * nWalls], vNearB.data() };
+        int nBenchCos = M.cosFix[37], nBenchSin = M.sinFix[37];
+        timeIt( "wall transform, scalar  ", 20, nWalls, "walls", [&]() {
+            transformWallsScalar( vMap.data(), nWalls, 100, -200, nBenchCos, nBenchSin, viewsA ); } );
+#ifdef GRID2D_AVX2
+        if (cpuHasAVX2()) {
+            timeIt( "wall transform, AVX2    ", 20, nWalls, "walls", [&]() {
+                transformWallsAVX2( vMap.data(), nWalls, 100, -200, nBenchCos, nBenchSin, viewsB ); } );
+            std::cout << "    identical to scalar: " << (vOutA == vOutB && vNearA == vNearB ? "yes" : "NO") << std::endl;
+        } else {
+            std::cout << "  wall transform, AVX2: not supported by this cpu" << std::endl;
+        }
+#endif
+
+        // texture sampling at random texel coordinates, on the 64 x 64 texture, through the shift and mask
+        // sampler and through the generic one (which textures of other sizes get). Both must read the same texels
+        const int nTexels = 1 << 20;
+        std::vector<int> vTexX( nTexels ), vTexY( nTexels );
+        std::uniform_int_distribution<int> distTex( 0, 1 << 20 );
+        for (int i = 0; i < nTexels; i++) {
+            vTexX[i] = distTex( rng );
+            vTexY[i] = distTex( rng );
+        }
+        const TexureMaps &texBench = Textures[9];
+        long long nSumPow2 = 0, nSumAny = 0;
+        timeIt( "texels, power of two    ", 20, nTexels, "texels", [&]() {
+            for (int i = 0; i < nTexels; i++) { nSumPow2 += SamplePow2::texel( texBench, vTexX[i], vTexY[i] )[1]; } } );
+        timeIt( "texels, generic         ", 20, nTexels, "texels", [&]() {
+            for (int i = 0; i < nTexels; i++) { nSumAny  += SampleAny::texel(  texBench, vTexX[i], vTexY[i] )[1]; } } );
+        std::cout << "    identical texels: " << (nSumPow2 == nSumAny ? "yes" : "NO") << std::endl;
+
+        // wall end point queries on 1M points spread over a large map: nearest point within a snap radius,
+        // checked against a linear scan, and moving points one by one as dragging them does
+        const int nPoints = 1 << 20, nQueries = 100000;
+        std::vector<KdPoint> vPoints( nPoints );
+        std::uniform_int_distribution<int> distMap( -(1 << 16), 1 << 16 );
+        for (int i = 0; i < nPoints; i++) {
+            vPoints[i] = { distMap( rng ), distMap( rng ), i };
+        }
+        std::vector<KdPoint> vPointsCopy = vPoints;
+        VertexTree vtBench;
+        timeIt( "points, k-d tree build  ", 1, nPoints, "points", [&]() { vPointsCopy = vPoints; vtBench.build( vPointsCopy ); } );
+        std::vector<float> vQueryX( nQueries ), vQueryY( nQueries );
+        for (int i = 0; i < nQueries; i++) {
+            vQueryX[i] = float( distMap( rng ));
+            vQueryY[i] = float( distMap( rng ));
+        }
+        const float fSnap = 256.0f;
+        std::vector<int> vNearest( nQueries );
+        timeIt( "points, nearest, k-d    ", 5, nQueries, "queries", [&]() {
+            for (int i = 0; i < nQueries; i++) { vNearest[i] = vtBench.nearest( vQueryX[i], vQueryY[i], fSnap ); } } );
+        auto nearestScan = [&]( float x, float y ) {
+            int nBest = -1;
+            float fBest = fSnap * fSnap;
+            for (const KdPoint &p : vPoints) {
+                float dx = x - p.x, dy = y - p.y, d = dx * dx + dy * dy;
+                if (d < fBest || (d == fBest && (nBest < 0 || p.id < nBest))) { nBest = p.id; fBest = d; }
+            }
+            return nBest;
+        };
+        const int nScans = 100;
+        int nScanMismatch = 0;
+        timeIt( "points, nearest, scan   ", 1, nScans, "queries", [&]() {
+            for (int i = 0; i < nScans; i++) { nScanMismatch += nearestScan( vQueryX[i], vQueryY[i] ) != vNearest[i]; } } );
+        std::cout << "    same as linear scan: " << (nScanMismatch == 0 ? "yes" : "NO") << std::endl;
+        std::uniform_int_distribution<int> distStep( -64, 64 ), distPoint( 0, nPoints - 1 );
+        timeIt( "points, move one by one ", 1, nQueries, "moves", [&]() {
+            for (int i = 0; i < nQueries; i++) {
+                KdPoint &p = vPoints[distPoint( rng )];
+                p.x += distStep( rng );
+                p.y += distStep( rng );
+                vtBench.setPoint( p.id, p.x, p.y );
+            } } );
+        nScanMismatch = 0;
+        for (int i = 0; i < nScans; i++) {
+            nScanMismatch += nearestScan( vQueryX[i], vQueryY[i] ) != vtBench.nearest( vQueryX[i], vQueryY[i], fSnap );
+        }
+        std::cout << "    same as linear scan after moves: " << (nScanMismatch == 0 ? "yes" : "NO") << std::endl;
+
+        // bulk edit of a selection of half the walls and sectors of a full map, against setting the fields item by
+        // item. The level is put back afterwards
+        std::vector<Wall>   vKeepW( W, W + MAX_WALL );
+        std::vector<Sector> vKeepS( S, S + MAX_SECT );
+        int nKeepWall = numWall, nKeepSect = numSect;
+        numSect = MAX_SECT;
+        numWall = MAX_WALL;
+        std::uniform_int_distribution<int> distSel( 0, 1 ), distVal( 0, 9 );
+        for (int w = 0; w < numWall; w++) {
+            W[w] = { w, w, w + 1, w + 1, distVal( rng ), distVal( rng ), distVal( rng ), distVal( rng ) };
+            vWallSel[w] = distSel( rng );
+        }
+        for (int s = 0; s < numSect; s++) {
+            S[s] = { s * 8, s * 8 + 8, distVal( rng ), distVal( rng ) + 10, 0, distVal( rng ), distVal( rng ), 0 };
+            vSectSel[s] = distSel( rng );
+        }
+        std::vector<Wall> vRefW( W, W + numWall );
+        std::vector<Sector> vRefS( S, S + numSect );
+        const int nEditAll = EDIT_WT | EDIT_WU | EDIT_WV | EDIT_ST | EDIT_SS | EDIT_Z;
+        timeIt( "bulk edit, per item     ", 20, numWall + numSect, "items", [&]() {
+            for (int w = 0; w < numWall; w++) {
+                if (vWallSel[w]) { vRefW[w].wt = G.wt; vRefW[w].u = G.wu; vRefW[w].v = G.wv; }
+            }
+            for (int s = 0; s < numSect; s++) {
+                if (vSectSel[s]) { vRefS[s].z1 = G.z1; vRefS[s].z2 = G.z2; vRefS[s].st = G.st; vRefS[s].ss = G.ss; }
+            } } );
+        timeIt( "bulk edit, masked pass  ", 20, numWall + numSect, "items", [&]() { bulkEdit( nEditAll ); } );
+        bool bSameEdit = std::equal( vRefW.begin(), vRefW.end(), W, []( const Wall &a, const Wall &b ) { return memcmp( &a, &b, sizeof( Wall )) == 0; } ) &&
+                         std::equal( vRefS.begin(), vRefS.end(), S, []( const Sector &a, const Sector &b ) { return memcmp( &a, &b, sizeof( Sector )) == 0; } );
+        std::cout << "    identical to per item: " << (bSameEdit ? "yes" : "NO") << std::endl;
+        // rotate, scale and mirror the selected sectors: the transform, snapping and shading pass
+        vXformSects.clear();
+        vXformBase.clear();
+        for (int s = 0; s < numSect; s++) {
+            if (vSectSel[s]) {
+                vXformSects.push_back( s );
+                vXformBase.insert( vXformBase.end(), W + S[s].ws, W + S[s].we );
+            }
+        }
+        Transform tBench = { 3, -2, 33, 5, true, false, 4096, 4096, -1, -1 };
+        timeIt( "transform sectors       ", 20, int( vXformBase.size()), "walls", [&]() { transformWalls( tBench, 8 * G.scale ); } );
+        // wall shades of a full map of walls in random directions, one by one and in a batch
+        std::uniform_int_distribution<int> distDir( -512, 512 );
+        for (int w = 0; w < numWall; w++) {
+            W[w].x2 = W[w].x1 + distDir( rng );
+            W[w].y2 = W[w].y1 + distDir( rng );
+        }
+        std::vector<int> vRefShade( numWall );
+        timeIt( "wall shades, atan2f     ", 20, numWall, "walls", [&]() {
+            for (int w = 0; w < numWall; w++) { vRefShade[w] = wallShade( W[w].x2 - W[w].x1, W[w].y2 - W[w].y1 ); } } );
+        timeIt( "wall shades, batch      ", 20, numWall, "walls", [&]() { shadeWalls( nullptr, numWall ); } );
+        bool bSameShade = true;
+        for (int w = 0; w < numWall; w++) {
+            bSameShade &= W[w].shade == vRefShade[w];
+        }
+        std::cout << "    identical to atan2f: " << (bSameShade ? "yes" : "NO") << std::endl;
+        // instances filling the map: the compare pass of syncInstances() when nothing was edited, and the write
+        // back and expansion of all instances after an edit of one of them
+        std::vector<Prefab>   vKeepPrefabs   = Prefabs;
+        std::vector<Instance> vKeepInstances = Instances;
+        Prefab pfBench;
+        for (int k = 0; k < 8; k++) {
+            pfBench.vSect.push_back( { k * 8, k * 8 + 8, 0, 40, 0, 1, 4, 0 } );
+            for (int j = 0; j < 8; j++) {
+                float a1 = j * 0.785398f, a2 = (j + 1) * 0.785398f;
+                pfBench.vWall.push_back( { k * 64 + int( 24 * cosf( a1 )), int( 24 * sinf( a1 )), k * 64 + int( 24 * cosf( a2 )), int( 24 * sinf( a2 )), 0, 1, 1, 0 } );
+            }
+        }
+        Prefabs = { pfBench };
+        Instances.clear();
+        numSect = 0;
+        numWall = 0;
+        for (int i = 0; numSect + 8 <= MAX_SECT && numWall + 64 <= MAX_WALL; i++) {
+            Instances.push_back( { 0, (i % 32) * 640, (i / 32) * 64, 0, i % 4, i % 3 == 0 } );
+            appendInstance( i );
+        }
+        VT.build( S, numSect, W );
+        timeIt( "instances, compare      ", 20, numWall, "walls", [&]() { V.nGeometry += 1; syncInstances(); } );
+        timeIt( "instances, edit one     ", 20, numWall, "walls", [&]() { S[0].z2 += 1; V.nGeometry += 1; syncInstances(); } );
+        // sector picking on the same map, against testing every sector
+        const int nPicks = 10000;
+        std::uniform_int_distribution<int> distPickX( -64, 32 * 640 ), distPickY( -64, (numSect / 256 + 1) * 64 );
+        std::vector<int> vPickX( nPicks ), vPickY( nPicks ), vPicked( nPicks );
+        for (int i = 0; i < nPicks; i++) {
+            vPickX[i] = distPickX( rng );
+            vPickY[i] = distPickY( rng );
+        }
+        pickSector( 0, 0 );
+        timeIt( "pick sector, index      ", 5, nPicks, "clicks", [&]() {
+            for (int i = 0; i < nPicks; i++) { vPicked[i] = pickSector( vPickX[i], vPickY[i] ); } } );
+        const int nPickScans = 100;
+        int nPickMismatch = 0;
+        timeIt( "pick sector, scan       ", 1, nPickScans, "clicks", [&]() {
+            for (int i = 0; i < nPickScans; i++) {
+                int nFound = -1;
+                for (int c = 0; c < numSect && nFound < 0; c++) {
+                    nFound = insideSector( c, vPickX[i], vPickY[i] ) ? c : -1;
+                }
+                nPickMismatch += nFound != vPicked[i];
+            } } );
+        std::cout << "    same as linear scan: " << (nPickMismatch == 0 ? "yes" : "NO") << std::endl;
+        Prefabs   = vKeepPrefabs;
+        Instances = vKeepInstances;
+        std::copy( vKeepW.begin(), vKeepW.end(), W );
+        std::copy( vKeepS.begin(), vKeepS.end(), S );
+        numWall = nKeepWall;
+        numSect = nKeepSect;
+        clearSelection();
+        VT.build( S, numSect, W );
+        V.nGeometry += 1;
+
+        // the 3D preview of the current level, seen from the player position
+        olc::Sprite spr3D( SW + SW3D, SH );
+        SetDrawTarget( &spr3D );
+        bool bKeep3D = b3DView;
+        b3DView = true;
+        timeIt( "3D view, current level", 100, SW3D * SH, "pixels", [&]() { draw3D(); } );
+        // same, from high up and looking down, so that most of the pane shows sector surfaces
+        Player keepP = P;
+        P.z += 150;
+        P.l += 10;
+        timeIt( "3D view, from above   ", 100, SW3D * SH, "pixels", [&]() { draw3D(); } );
+        P = keepP;
+        b3DView = bKeep3D;
+
+        SetDrawTarget( nullptr );
     }
 
     int nOldMouseX, nOldMouseY;    // cache previous mouse position (to detect mouse movement)
@@ -736,8 +4116,28 @@ public:
         if (GetKey( olc::Key::I ).bPressed) {
             bInfoFlag = !bInfoFlag;
         }
-
-        Clear( olc::DARK_GREEN );
+        // toggle anti aliased walls
+        if (GetKey( olc::Key::L ).bPressed) {
+            bAntiAlias = !bAntiAlias;
+        }
+        // toggle the 3D preview
+        if (GetKey( olc::Key::V ).bPressed) {
+            b3DView = !b3DView;
+        }
+        // toggle multi threaded rasterization
+        if (GetKey( olc::Key::T ).bPressed) {
+            bThreaded = !bThreaded;
+        }
+        // run the benchmarks
+        if (GetKey( olc::Key::B ).bPressed) {
+            runBenchmarks();
+        }
+        // toggle event driven rendering, and adjust the frame rate cap
+        if (GetKey( olc::Key::F ).bPressed) {
+            T.bEventDriven = !T.bEventDriven;
+        }
+        if (GetKey( olc::Key::F1 ).bPressed) { adjustFpsCap( -1 ); }
+        if (GetKey( olc::Key::F2 ).bPressed) { adjustFpsCap( +1 ); }
 
         // grab mouse coordinates
         int nMouseX = GetMouseX();
@@ -750,15 +4150,38 @@ public:
             // if so, call mouseMoving()
             mouseMoving( nUseMouseX, nUseMouseY );
         }
+        // zoom and pan the 2D view
+        moveView( nMouseX, nMouseY );
         // reset previouis mouse coordinates
         nOldMouseX = nMouseX;
         nOldMouseY = nMouseY;
         // call mouse handler
         mouse( nUseMouseX, nUseMouseY );
-        // call keyboard handler
+        // call keyboard handlers
         movePlayer();
+        transformKeys();
+        prefabKeys();
+        // instances follow the edits of their prefabs
+        syncInstances();
+        // walls that were drawn or dragged get their shade
+        updateShades();
+
+        // in event driven mode, only render when something on screen changed. Otherwise the previous frame
+        // stays in the draw target, and is presented again
+        FrameState frameNow = frameState( nMouseX, nMouseY );
+        bool bDraw = !T.bEventDriven || bForceFrame || frameNow != frameLast;
+        frameLast = frameNow;
+        bForceFrame = false;
+        frameStats( fElapsedTime, bDraw );
+        if (!bDraw) {
+            paceFrame( false );
+            return true;
+        }
+        auto tStart = std::chrono::steady_clock::now();
+
         // display what you got
-        display( fElapsedTime );
+        Clear( olc::DARK_GREEN );
+        display();
 
         if (bInfoFlag) {
             // display test info on the player and mouse pos
@@ -771,7 +4194,24 @@ public:
             DrawString( 2, SH - 10, "Mse: ("  + std::to_string( nUseMouseX ) +
                                     ", "      + std::to_string( nUseMouseY ) +
                                     ")" );
+            // frame stats: frames processed / rendered per second, cap and render time of the last frame
+            DrawString( 2, 2,  "fps: "   + std::to_string( int( T.fFps + 0.5f )) +
+                               " / "     + std::to_string( int( T.fDrawFps + 0.5f )) );
+            DrawString( 2, 12, "cap: "   + (T.nFpsCap > 0 ? std::to_string( T.nFpsCap ) : std::string( "off" )) +
+                               (T.bEventDriven ? " evt" : "") );
+            DrawString( 2, 22, "ms: "    + std::to_string( T.fWork * 1000.0f ).substr( 0, 5 ));
+            DrawString( 2, 32, "sec: "   + std::to_string( nPlayerSect ));
+            if (nSelSects + nSelWalls > 0) {
+                DrawString( 2, 42, "sel: " + std::to_string( nSelSects ) + " s, " + std::to_string( nSelWalls ) + " w" );
+            }
+            if (!Prefabs.empty()) {
+                DrawString( 2, 52, "pfb: " + std::to_string( nPrefab ) + " / " + std::to_string( Prefabs.size()));
+            }
         }
+        std::chrono::duration<float> tWork = std::chrono::steady_clock::now() - tStart;
+        T.fWork = tWork.count();
+
+        paceFrame( true );
 
         return true;
     }
@@ -779,15 +4219,107 @@ public:
     bool OnUserDestroy() override {
 
         // your clean up code here
+        delete layerStatic.pSprite;
+        delete pPool;
         return true;
     }
+
+    // headless rendering, without a window: draw each level of vJobs (pairs of level file and image file)
+    // into an offscreen sprite, and write it as .png or .ppm. Only the 2D editor is drawn if bWith3D is
+    // false. Returns the number of jobs that failed
+    int renderToFiles( const std::vector<std::string> &vJobs, bool bWith3D ) {
+        init();
+        b3DView = bWith3D;
+        olc::Sprite spr( bWith3D ? SW + SW3D : SW, SH );
+        SetDrawTarget( &spr );
+
+        int nFailed = 0;
+        auto tStart = std::chrono::steady_clock::now();
+        for (size_t j = 0; j + 1 < vJobs.size(); j += 2) {
+            const std::string &sLevel = vJobs[j], &sImage = vJobs[j + 1];
+            // every level starts from the default 2D view, like it would in a fresh editor
+            initView();
+            if (!load( sLevel )) {
+                nFailed += 1;
+                continue;
+            }
+            Clear( olc::DARK_GREEN );
+            draw2D();
+            darken();
+            if (bWith3D) {
+                draw3D();
+            }
+            std::string sExt = sImage.substr( std::min( sImage.find_last_of( '.' ), sImage.size() ));
+            std::transform( sExt.begin(), sExt.end(), sExt.begin(), []( unsigned char c ) { return char( std::tolower( c )); } );
+            bool bOk = false;
+            if (sExt == ".png") {
+                bOk = writePNG( sImage, spr );
+            } else if (sExt == ".ppm") {
+                bOk = writePPM( sImage, spr );
+            } else {
+                std::cout << "ERROR: renderToFiles() --> unknown image type (use .png or .ppm): " << sImage << std::endl;
+            }
+            nFailed += bOk ? 0 : 1;
+        }
+        std::chrono::duration<double> tElapsed = std::chrono::steady_clock::now() - tStart;
+        int nJobs = int( vJobs.size() / 2 );
+        std::cout << "rendered " << nJobs - nFailed << " of " << nJobs << " levels in "
+                  << tElapsed.count() * 1000.0 << " ms" << std::endl;
+
+        OnUserDestroy();
+        return nFailed;
+    }
+
+    // self test for scripts and CI (--selftest): the fixed point 3D path against the float path on 100k random walls.
+    // Returns 0 if it passed, 1 if not
+    int selfTest() {
+        init();
+        std::mt19937 rng( 2024 );
+        bool bPassed = checkProjection( testWalls( 100000, rng ));
+        std::cout << "self test " << (bPassed ? "passed" : "FAILED") << std::endl;
+        OnUserDestroy();
+        return bPassed ? 0 : 1;
+    }
 };
 
 
-int main()
+int main( int argc, char *argv[] )
 {
+	// command line:
+	//     grid2d [--res <w>x<h>] [--scale <n>]
+	// sets the size of the editor (and of the 3D pane next to it) in logical pixels, and the size of a logical
+	// pixel on screen. Headless mode, e.g. for thumbnails and image based tests on machines without a display:
+	//     grid2d [--res <w>x<h>] --render [--no3d] <level file> <image file> [<level file> <image file> ...]
+	// and a self test of the 3D fixed point path, which exits with 1 if it fails:
+	//     grid2d [--res <w>x<h>] --selftest
+	std::vector<std::string> vJobs;
+	bool bRender = false, bWith3D = true, bSelfTest = false, bUsage = false;
+	int nResW = SW, nResH = SH, nScale = pixelSize;
+	for (int i = 1; i < argc; i++) {
+		std::string sArg = argv[i];
+		if      (sArg == "--render") { bRender = true;  }
+		else if (sArg == "--no3d"  ) { bWith3D = false; }
+		else if (sArg == "--selftest") { bSelfTest = true; }
+		else if (sArg == "--res"   ) { bUsage |= i + 1 == argc || sscanf( argv[++i], "%dx%d", &nResW, &nResH ) != 2; }
+		else if (sArg == "--scale" ) { bUsage |= i + 1 == argc || sscanf( argv[++i], "%d",    &nScale        ) != 1; }
+		else                         { vJobs.push_back( sArg ); }
+	}
+	if (bUsage || (bRender && (vJobs.empty() || vJobs.size() % 2 != 0)) || (!bRender && !vJobs.empty()) || (bSelfTest && bRender)) {
+		std::cout << "usage: " << argv[0] << " [--res <w>x<h>] [--scale <n>]" << std::endl;
+		std::cout << "       " << argv[0] << " [--res <w>x<h>] --render [--no3d] <level file> <image file> [...]" << std::endl;
+		std::cout << "       " << argv[0] << " [--res <w>x<h>] --selftest" << std::endl;
+		return 1;
+	}
+	setResolution( nResW, nResH, nScale );
+
 	Grid2D_port demo;
-	if (demo.Construct( SW, SH, pixelSize, pixelSize )) {
+	if (bRender) {
+		return demo.renderToFiles( vJobs, bWith3D ) == 0 ? 0 : 1;
+	}
+	if (bSelfTest) {
+		return demo.selfTest();
+	}
+	if (demo.Construct( SW + SW3D, SH, pixelSize, pixelSize )) {
 		demo.Start();
 	} else {
         std::cout << "ERROR: main() --> Failure to construct window ..." << std::endl;
@@ -795,4 +4327,3 @@ int main()
 
 	return 0;
 }
-